@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+// clCreateCommandQueue remains the only way to create a queue on the devices older than OpenCL 2.0
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#include "bench.h"
+#include "clc.h"
+#include "file.h"
+#include "log.h"
+#include "scope_guard.h"
+#include "tuning.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Queries the OpenCL version a device supports
+ * @param[in] device Device to query
+ * @return The version as major * 100 + minor * 10, as CL_TARGET_OPENCL_VERSION, 0 if it could not be determined
+ */
+unsigned device_version(cl_device_id device)
+{
+    size_t len;
+    if (clGetDeviceInfo(device, CL_DEVICE_VERSION, 0, nullptr, &len) != CL_SUCCESS || len == 0)
+    {
+        return 0;
+    }
+    std::vector<char> version(len);
+    unsigned major, minor;
+    if (clGetDeviceInfo(device, CL_DEVICE_VERSION, len, version.data(), nullptr) != CL_SUCCESS ||
+        std::sscanf(version.data(), "OpenCL %u.%u", &major, &minor) != 2)
+    {
+        return 0;
+    }
+    return major * 100 + minor * 10;
+}
+
+/** Stores a scalar argument value
+ * @param[in] v Value
+ * @param[out] arg Receives the value
+ */
+template <typename T> void set_scalar(T v, bench_arg &arg)
+{
+    arg.size = sizeof(v);
+    arg.value.resize(sizeof(v));
+    std::memcpy(arg.value.data(), &v, sizeof(v));
+}
+
+/** Parses a kernel argument
+ * @param[in] text Argument as <type>:<value>
+ * @param[out] arg Receives the argument
+ * @return true if succeeded, false if malformed
+ */
+bool parse_arg(const std::string &text, bench_arg &arg)
+{
+    size_t colon = text.find(':');
+    if (colon == std::string::npos || colon + 1 == text.size())
+    {
+        return false;
+    }
+    std::string type = text.substr(0, colon);
+    const char *value = text.c_str() + colon + 1;
+    char *end;
+
+    if (type == "buffer" || type == "local")
+    {
+        arg.type = type == "buffer" ? bench_arg::kind::buffer : bench_arg::kind::local;
+        arg.size = static_cast<size_t>(std::strtoull(value, &end, 10));
+        return !*end && arg.size > 0;
+    }
+
+    arg.type = bench_arg::kind::scalar;
+    if (type == "int")
+    {
+        set_scalar(static_cast<cl_int>(std::strtol(value, &end, 0)), arg);
+    }
+    else if (type == "uint")
+    {
+        set_scalar(static_cast<cl_uint>(std::strtoul(value, &end, 0)), arg);
+    }
+    else if (type == "long")
+    {
+        set_scalar(static_cast<cl_long>(std::strtoll(value, &end, 0)), arg);
+    }
+    else if (type == "ulong")
+    {
+        set_scalar(static_cast<cl_ulong>(std::strtoull(value, &end, 0)), arg);
+    }
+    else if (type == "float")
+    {
+        set_scalar(static_cast<cl_float>(std::strtod(value, &end)), arg);
+    }
+    else if (type == "double")
+    {
+        set_scalar(static_cast<cl_double>(std::strtod(value, &end)), arg);
+    }
+    else
+    {
+        return false;
+    }
+    return !*end;
+}
+
+/** Fills a buffer argument with deterministic floats in [0, 1)
+ * @param[in] index Argument index, seeding the values so that every run sees the same inputs
+ * @param[out] data Buffer to fill
+ */
+void fill_buffer(cl_uint index, std::vector<unsigned char> &data)
+{
+    uint32_t x = 0x9e3779b9u * (index + 1);
+    for (size_t i = 0; i + sizeof(cl_float) <= data.size(); i += sizeof(cl_float))
+    {
+        x = x * 1664525u + 1013904223u;
+        cl_float f = static_cast<cl_float>(x >> 8) / 16777216.0f;
+        std::memcpy(&data[i], &f, sizeof(f));
+    }
+}
+
+} // namespace
+
+bool load_kernel_specs(const char *fn, std::vector<kernel_spec> &specs)
+{
+    std::ifstream in(fn);
+    if (!in)
+    {
+        logerr("failed opening the kernel spec file \"%s\"\n", fn);
+        return false;
+    }
+
+    std::string line;
+    for (unsigned lineno = 1; std::getline(in, line); ++lineno)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::vector<std::string> fields = split_fields(line);
+        kernel_spec spec;
+        spec.kernel = fields[0];
+        if (fields.size() < 2 || fields.size() > 4 || spec.kernel.empty() ||
+            !parse_ndrange(fields[1], spec.dims, spec.global))
+        {
+            logerr("%s:%u: malformed kernel spec\n", fn, lineno);
+            return false;
+        }
+
+        if (fields.size() > 2 && !fields[2].empty())
+        {
+            cl_uint dims;
+            if (!parse_ndrange(fields[2], dims, spec.local) || dims != spec.dims)
+            {
+                logerr("%s:%u: malformed local size \"%s\"\n", fn, lineno, fields[2].c_str());
+                return false;
+            }
+        }
+
+        if (fields.size() > 3)
+        {
+            std::istringstream args(fields[3]);
+            std::string text;
+            while (args >> text)
+            {
+                bench_arg arg;
+                if (!parse_arg(text, arg))
+                {
+                    logerr("%s:%u: malformed kernel argument \"%s\"\n", fn, lineno, text.c_str());
+                    return false;
+                }
+                spec.args.push_back(arg);
+            }
+        }
+        specs.push_back(spec);
+    }
+
+    return true;
+}
+
+kernel_runner::~kernel_runner()
+{
+    if (m_queue)
+    {
+        clReleaseCommandQueue(m_queue);
+    }
+}
+
+bool kernel_runner::init(const compiler &c)
+{
+    m_context = c.context();
+    m_device = c.device();
+
+    // the headers may know of OpenCL 2.0 while the device does not, the entry point then being missing or failing
+    cl_int err;
+#ifdef CL_VERSION_2_0
+    if (device_version(m_device) >= 200)
+    {
+        cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+        m_queue = clCreateCommandQueueWithProperties(m_context, m_device, properties, &err);
+    }
+    else
+#endif
+    {
+        m_queue = clCreateCommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE, &err);
+    }
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed creating a profiling command queue (err=%s)\n", cl_error_str(err));
+        m_queue = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool kernel_runner::run(cl_program program, const kernel_spec &spec, unsigned runs, kernel_timing &timing) const
+{
+    cl_int err;
+    cl_kernel kernel = clCreateKernel(program, spec.kernel.c_str(), &err);
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed creating the kernel \"%s\" (err=%s)\n", spec.kernel.c_str(), cl_error_str(err));
+        return false;
+    }
+    on_scope_guard([kernel]() { clReleaseKernel(kernel); });
+
+    std::vector<cl_mem> buffers;
+    std::vector<size_t> sizes;
+    on_scope_guard([&buffers]() {
+        for (cl_mem b : buffers)
+        {
+            clReleaseMemObject(b);
+        }
+    });
+
+    for (cl_uint i = 0; i < spec.args.size(); ++i)
+    {
+        const bench_arg &arg = spec.args[i];
+        if (arg.type == bench_arg::kind::buffer)
+        {
+            std::vector<unsigned char> data(arg.size);
+            fill_buffer(i, data);
+            cl_mem buffer =
+                clCreateBuffer(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, arg.size, data.data(), &err);
+            if (err != CL_SUCCESS)
+            {
+                logerr("failed allocating a %zu bytes buffer for \"%s\" (err=%s)\n", arg.size, spec.kernel.c_str(),
+                       cl_error_str(err));
+                return false;
+            }
+            buffers.push_back(buffer);
+            sizes.push_back(arg.size);
+            err = clSetKernelArg(kernel, i, sizeof(buffer), &buffer);
+        }
+        else if (arg.type == bench_arg::kind::local)
+        {
+            err = clSetKernelArg(kernel, i, arg.size, nullptr);
+        }
+        else
+        {
+            err = clSetKernelArg(kernel, i, arg.size, arg.value.data());
+        }
+        if (err != CL_SUCCESS)
+        {
+            logerr("failed setting the argument %u of \"%s\" (err=%s)\n", i, spec.kernel.c_str(), cl_error_str(err));
+            return false;
+        }
+    }
+
+    const size_t *local = spec.local[0] ? spec.local : nullptr;
+    std::vector<double> times;
+    for (unsigned r = 0; r <= runs; ++r)
+    {
+        cl_event event;
+        err = clEnqueueNDRangeKernel(m_queue, kernel, spec.dims, nullptr, spec.global, local, 0, nullptr, &event);
+        if (err != CL_SUCCESS)
+        {
+            logerr("failed running \"%s\" (err=%s)\n", spec.kernel.c_str(), cl_error_str(err));
+            return false;
+        }
+        on_scope_guard([event]() { clReleaseEvent(event); });
+
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        err = clWaitForEvents(1, &event);
+        if (err == CL_SUCCESS)
+        {
+            err = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+        }
+        if (err == CL_SUCCESS)
+        {
+            err = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+        }
+        if (err != CL_SUCCESS)
+        {
+            logerr("failed profiling \"%s\" (err=%s)\n", spec.kernel.c_str(), cl_error_str(err));
+            return false;
+        }
+
+        // the first run warms up and captures the outputs
+        if (r == 0)
+        {
+            timing.outputs.clear();
+            for (size_t b = 0; b < buffers.size(); ++b)
+            {
+                std::vector<unsigned char> data(sizes[b]);
+                err = clEnqueueReadBuffer(m_queue, buffers[b], CL_TRUE, 0, data.size(), data.data(), 0, nullptr,
+                                          nullptr);
+                if (err != CL_SUCCESS)
+                {
+                    logerr("failed reading the outputs of \"%s\" (err=%s)\n", spec.kernel.c_str(), cl_error_str(err));
+                    return false;
+                }
+                timing.outputs.push_back(std::move(data));
+            }
+            continue;
+        }
+        times.push_back((end - start) * 1e-9);
+    }
+
+    timing.kernel = spec.kernel;
+    timing.runs = runs;
+    if (!times.empty())
+    {
+        std::sort(times.begin(), times.end());
+        timing.min = times.front();
+        timing.max = times.back();
+        size_t mid = times.size() / 2;
+        timing.median = times.size() % 2 ? times[mid] : (times[mid - 1] + times[mid]) / 2;
+        double sum = 0;
+        for (double t : times)
+        {
+            sum += t;
+        }
+        timing.mean = sum / times.size();
+    }
+    return true;
+}
+
+bool bench_program(const compiler &c, const kernel_runner &runner, const std::string &source,
+                   const std::string &options, const std::vector<kernel_spec> &specs, unsigned runs,
+                   std::vector<kernel_timing> &timings)
+{
+    cl_program program = c.build_program(source.c_str(), options.c_str());
+    if (!program)
+    {
+        return false;
+    }
+    on_scope_guard([program]() { clReleaseProgram(program); });
+
+    timings.clear();
+    for (const std::string &name : get_kernel_names(program))
+    {
+        auto spec =
+            std::find_if(specs.begin(), specs.end(), [&name](const kernel_spec &s) { return s.kernel == name; });
+        if (spec == specs.end())
+        {
+            loginfo("no spec for the kernel \"%s\", not benchmarking it\n", name.c_str());
+            continue;
+        }
+
+        kernel_timing timing;
+        if (!runner.run(program, *spec, runs, timing))
+        {
+            return false;
+        }
+        timings.push_back(std::move(timing));
+    }
+    return true;
+}
+
+void print_timings(const std::string &name, const std::string &identity, const std::vector<kernel_timing> &timings)
+{
+    for (const kernel_timing &t : timings)
+    {
+        std::printf("bench: program=%s kernel=%s device=\"%s\" runs=%u min_us=%.3f median_us=%.3f mean_us=%.3f "
+                    "max_us=%.3f\n",
+                    name.c_str(), t.kernel.c_str(), identity.c_str(), t.runs, t.min * 1e6, t.median * 1e6,
+                    t.mean * 1e6, t.max * 1e6);
+    }
+}
+
+bool bench_inputs(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<build_input> &inputs,
+                  const std::vector<kernel_spec> &specs, unsigned runs)
+{
+    std::vector<std::unique_ptr<kernel_runner>> runners;
+    for (const auto &c : compilers)
+    {
+        runners.emplace_back(new kernel_runner);
+        if (!runners.back()->init(*c))
+        {
+            return false;
+        }
+    }
+
+    bool ok = true;
+    for (const build_input &input : inputs)
+    {
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            ok = false;
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+
+        for (size_t b = 0; b < compilers.size(); ++b)
+        {
+            if (!input.builders.empty() &&
+                std::find(input.builders.begin(), input.builders.end(), b) == input.builders.end())
+            {
+                continue;
+            }
+
+            std::vector<kernel_timing> timings;
+            if (!bench_program(*compilers[b], *runners[b], text, input.options, specs, runs, timings))
+            {
+                logerr("failed benchmarking \"%s\"\n", input.filename.c_str());
+                ok = false;
+                continue;
+            }
+            print_timings(input.name, compilers[b]->identity(), timings);
+        }
+    }
+    return ok;
+}
+
+} // namespace clc
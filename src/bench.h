@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef bench_h
+#define bench_h
+
+#include "driver.h"
+
+#include <CL/cl.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+class compiler;
+
+/** Synthetic argument of a benchmarked kernel */
+struct bench_arg
+{
+    /** Kind of argument */
+    enum class kind
+    {
+        /** global buffer, filled with floats in [0, 1) */
+        buffer,
+
+        /** local memory */
+        local,
+
+        /** value passed by copy */
+        scalar,
+    };
+
+    /** Kind of argument */
+    kind type = kind::scalar;
+
+    /** Size in bytes of the buffer, local memory or scalar */
+    size_t size = 0;
+
+    /** Bytes of the scalar value */
+    std::vector<unsigned char> value;
+};
+
+/** How to run a kernel for benchmarking */
+struct kernel_spec
+{
+    /** Kernel name */
+    std::string kernel;
+
+    /** Number of dimensions of the NDRange */
+    cl_uint dims = 1;
+
+    /** Global size */
+    size_t global[3] = {1, 1, 1};
+
+    /** Local size, all 0 to let the driver choose */
+    size_t local[3] = {0, 0, 0};
+
+    /** Kernel arguments */
+    std::vector<bench_arg> args;
+};
+
+/** Loads the kernel specs of a benchmark
+ *
+ * The spec file lists one kernel per line as tab separated fields:
+ *
+ *     <kernel name><TAB><global size>[<TAB><local size>[<TAB><arguments>]]
+ *
+ * Sizes are given as <x>[x<y>[x<z>]], an empty local size lets the driver choose. Arguments are whitespace separated,
+ * in order, among buffer:<bytes>, local:<bytes>, int:<value>, uint:<value>, long:<value>, ulong:<value>,
+ * float:<value> and double:<value>. Empty lines and lines starting with '#' are ignored.
+ *
+ * @param[in] fn Spec filename
+ * @param[out] specs Receives the kernel specs
+ * @return true if succeeded, false otherwise
+ */
+bool load_kernel_specs(const char *fn, std::vector<kernel_spec> &specs);
+
+/** Execution time statistics of a kernel */
+struct kernel_timing
+{
+    /** Kernel name */
+    std::string kernel;
+
+    /** Number of timed runs */
+    unsigned runs = 0;
+
+    /** Execution time statistics in seconds, from the profiling of the NDRange commands */
+    double min = 0;
+    double median = 0;
+    double mean = 0;
+    double max = 0;
+
+    /** Content of the buffer arguments after the first run */
+    std::vector<std::vector<unsigned char>> outputs;
+};
+
+/** Runs kernels on a profiling command queue */
+class kernel_runner
+{
+  public:
+    kernel_runner() = default;
+    ~kernel_runner();
+
+    kernel_runner(const kernel_runner &) = delete;
+    kernel_runner &operator=(const kernel_runner &) = delete;
+
+    /** Creates the profiling command queue
+     * @param[in] c Compiler whose context and device to run on
+     * @return true if succeeded, false otherwise
+     */
+    bool init(const compiler &c);
+
+    /** Benchmarks a kernel
+     *
+     * The kernel runs once untimed with freshly initialized arguments, which also captures its outputs, then
+     * @p runs more times.
+     *
+     * @param[in] program Built program of the kernel
+     * @param[in] spec How to run the kernel
+     * @param[in] runs Number of timed runs
+     * @param[out] timing Receives the execution time statistics
+     * @return true if succeeded, false otherwise
+     */
+    bool run(cl_program program, const kernel_spec &spec, unsigned runs, kernel_timing &timing) const;
+
+  private:
+    /** context of the compiler */
+    cl_context m_context = nullptr;
+
+    /** device of the compiler */
+    cl_device_id m_device = nullptr;
+
+    /** profiling command queue */
+    cl_command_queue m_queue = nullptr;
+};
+
+/** Builds a program and benchmarks its kernels having a spec
+ *
+ * @param[in] c Compiler to build with
+ * @param[in] runner Runner on the same device
+ * @param[in] source Source text
+ * @param[in] options Build options
+ * @param[in] specs Kernel specs, kernels with no spec are not run
+ * @param[in] runs Number of timed runs per kernel
+ * @param[out] timings Receives the statistics of each benchmarked kernel
+ * @return true if succeeded, false if the program failed to build or a kernel to run
+ */
+bool bench_program(const compiler &c, const kernel_runner &runner, const std::string &source,
+                   const std::string &options, const std::vector<kernel_spec> &specs, unsigned runs,
+                   std::vector<kernel_timing> &timings);
+
+/** Prints the execution time statistics of kernels to stdout
+ * @param[in] name Program name
+ * @param[in] identity Device identity, see @ref device_identity
+ * @param[in] timings Statistics to print
+ */
+void print_timings(const std::string &name, const std::string &identity, const std::vector<kernel_timing> &timings);
+
+/** Benchmarks the kernels of every input on every device it targets, one program at a time
+ *
+ * @param[in] compilers Compiler of each device, indexed like the @ref build_input::builders
+ * @param[in] inputs Inputs to benchmark
+ * @param[in] specs Kernel specs
+ * @param[in] runs Number of timed runs per kernel
+ * @return true if every input was benchmarked, false otherwise
+ */
+bool bench_inputs(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<build_input> &inputs,
+                  const std::vector<kernel_spec> &specs, unsigned runs);
+
+} // namespace clc
+
+#endif // bench_h
@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "bundle.h"
+#include "hash.h"
+#include "log.h"
+#include "scope_guard.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace clc
+{
+
+namespace
+{
+
+/** @return true if the host is little endian, the only byte order bundles are written in */
+bool host_is_little_endian()
+{
+    const uint32_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+/** Rounds a value up to a multiple of an alignment
+ * @param[in] v Value to round up
+ * @param[in] alignment Power of two alignment
+ * @return The rounded value
+ */
+uint64_t align_up(uint64_t v, uint64_t alignment)
+{
+    return (v + alignment - 1) & ~(alignment - 1);
+}
+
+/** @return Offset of the entries table for a hash table of @p bucket_count buckets */
+uint64_t entries_offset(uint32_t bucket_count)
+{
+    return align_up(sizeof(bundle_header) + sizeof(uint32_t) * static_cast<uint64_t>(bucket_count), 8);
+}
+
+} // namespace
+
+uint64_t bundle_key(const std::string &name, const std::string &identity)
+{
+    return fnv1a64(identity, fnv1a64(name));
+}
+
+std::vector<unsigned char> kernel_map_data(const std::map<std::string, std::string> &map)
+{
+    std::string text;
+    for (const auto &k : map)
+    {
+        text += k.first + '\t' + k.second + '\n';
+    }
+    return std::vector<unsigned char>(text.begin(), text.end());
+}
+
+std::map<std::string, std::string> parse_kernel_map(const unsigned char *data, size_t size)
+{
+    std::map<std::string, std::string> map;
+    const char *p = reinterpret_cast<const char *>(data);
+    const char *end = p + size;
+    while (p < end)
+    {
+        const char *eol = std::find(p, end, '\n');
+        const char *tab = std::find(p, eol, '\t');
+        if (tab != eol)
+        {
+            map[std::string(p, tab)] = std::string(tab + 1, eol);
+        }
+        p = eol == end ? end : eol + 1;
+    }
+    return map;
+}
+
+void bundle_writer::add(const std::string &name, const std::string &identity, std::vector<unsigned char> binary)
+{
+    auto found = m_index.find(std::make_pair(name, identity));
+    if (found != m_index.end())
+    {
+        m_items[found->second].binary = std::move(binary);
+        return;
+    }
+    m_index[std::make_pair(name, identity)] = m_items.size();
+
+    item i;
+    i.name = name;
+    i.identity = identity;
+    i.binary = std::move(binary);
+    m_items.push_back(std::move(i));
+}
+
+bool bundle_writer::find(const std::string &name, const std::string &identity, std::vector<unsigned char> &binary) const
+{
+    auto found = m_index.find(std::make_pair(name, identity));
+    if (found == m_index.end())
+    {
+        return false;
+    }
+    binary = m_items[found->second].binary;
+    return true;
+}
+
+bool bundle_writer::write(const char *fn) const
+{
+    if (!host_is_little_endian())
+    {
+        logerr("bundles can only be written on little endian hosts\n");
+        return false;
+    }
+
+    bundle_header header;
+    std::memcpy(header.magic, "CLCB", 4);
+    header.version = bundle_version;
+    header.entry_count = static_cast<uint32_t>(m_items.size());
+    header.bucket_count = 2;
+    while (header.bucket_count < 2 * header.entry_count)
+    {
+        header.bucket_count *= 2;
+    }
+
+    // string table
+    std::string strings;
+    std::vector<bundle_entry> entries(m_items.size());
+    for (size_t i = 0; i < m_items.size(); ++i)
+    {
+        bundle_entry &e = entries[i];
+        e.key = bundle_key(m_items[i].name, m_items[i].identity);
+        e.name_offset = static_cast<uint32_t>(strings.size());
+        e.name_size = static_cast<uint32_t>(m_items[i].name.size());
+        strings += m_items[i].name;
+        e.device_offset = static_cast<uint32_t>(strings.size());
+        e.device_size = static_cast<uint32_t>(m_items[i].identity.size());
+        strings += m_items[i].identity;
+    }
+    header.strings_offset = entries_offset(header.bucket_count) + sizeof(bundle_entry) * entries.size();
+    header.strings_size = strings.size();
+
+    // binaries
+    uint64_t offset = header.strings_offset + header.strings_size;
+    for (size_t i = 0; i < m_items.size(); ++i)
+    {
+        offset = align_up(offset, bundle_alignment);
+        entries[i].data_offset = offset;
+        entries[i].data_size = m_items[i].binary.size();
+        offset += entries[i].data_size;
+    }
+
+    // hash table
+    std::vector<uint32_t> buckets(header.bucket_count, 0);
+    const uint32_t mask = header.bucket_count - 1;
+    for (uint32_t i = 0; i < header.entry_count; ++i)
+    {
+        uint32_t b = static_cast<uint32_t>(entries[i].key) & mask;
+        while (buckets[b])
+        {
+            b = (b + 1) & mask;
+        }
+        buckets[b] = i + 1;
+    }
+
+    FILE *f = std::fopen(fn, "wb");
+    if (!f)
+    {
+        logerr("failed creating the bundle \"%s\"\n", fn);
+        return false;
+    }
+    on_scope_guard_named(failedWrite, [=]() {
+        std::fclose(f);
+        std::remove(fn);
+    });
+
+    static const char padding[bundle_alignment] = {};
+    uint64_t written = 0;
+    auto put = [f, &written](const void *data, uint64_t size) {
+        written += size;
+        return std::fwrite(data, 1, size, f) == size;
+    };
+    auto pad = [&put, &written](uint64_t to) { return put(padding, to - written); };
+
+    bool ok = put(&header, sizeof(header)) && put(buckets.data(), sizeof(uint32_t) * buckets.size()) &&
+              pad(entries_offset(header.bucket_count)) && put(entries.data(), sizeof(bundle_entry) * entries.size()) &&
+              put(strings.data(), strings.size());
+    for (size_t i = 0; ok && i < m_items.size(); ++i)
+    {
+        ok = pad(entries[i].data_offset) && put(m_items[i].binary.data(), m_items[i].binary.size());
+    }
+    if (!ok)
+    {
+        logerr("failed writing the bundle \"%s\"\n", fn);
+        return false;
+    }
+
+    failedWrite.dismiss();
+    if (std::fclose(f) != 0)
+    {
+        logerr("failed writing the bundle \"%s\"\n", fn);
+        std::remove(fn);
+        return false;
+    }
+
+    return true;
+}
+
+bundle::~bundle()
+{
+    close();
+}
+
+void bundle::close()
+{
+#ifndef _WIN32
+    if (m_mapped)
+    {
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+#endif
+    if (!m_mapped)
+    {
+        delete[] m_data;
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_mapped = false;
+    m_header = nullptr;
+    m_buckets = nullptr;
+    m_entries = nullptr;
+}
+
+bool bundle::open(const char *fn)
+{
+    close();
+
+    if (!host_is_little_endian())
+    {
+        logerr("bundles can only be read on little endian hosts\n");
+        return false;
+    }
+
+#ifndef _WIN32
+    int fd = ::open(fn, O_RDONLY);
+    if (fd < 0)
+    {
+        logerr("failed opening the bundle \"%s\"\n", fn);
+        return false;
+    }
+    on_scope_guard([fd]() { ::close(fd); });
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(bundle_header)))
+    {
+        logerr("\"%s\" is not a valid bundle\n", fn);
+        return false;
+    }
+
+    void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        logerr("failed mapping the bundle \"%s\"\n", fn);
+        return false;
+    }
+    m_data = static_cast<const unsigned char *>(data);
+    m_size = static_cast<size_t>(st.st_size);
+    m_mapped = true;
+#else
+    FILE *f = std::fopen(fn, "rb");
+    if (!f)
+    {
+        logerr("failed opening the bundle \"%s\"\n", fn);
+        return false;
+    }
+    on_scope_guard([f]() { std::fclose(f); });
+
+    long flen;
+    if (std::fseek(f, 0, SEEK_END) < 0 || (flen = std::ftell(f)) < static_cast<long>(sizeof(bundle_header)) ||
+        std::fseek(f, 0, SEEK_SET) < 0)
+    {
+        logerr("\"%s\" is not a valid bundle\n", fn);
+        return false;
+    }
+
+    unsigned char *data = new unsigned char[flen];
+    m_data = data;
+    m_size = static_cast<size_t>(flen);
+    if (std::fread(data, 1, m_size, f) != m_size)
+    {
+        logerr("failed reading the bundle \"%s\"\n", fn);
+        close();
+        return false;
+    }
+#endif
+
+    const bundle_header *header = reinterpret_cast<const bundle_header *>(m_data);
+    uint64_t index_end = 0;
+    bool valid = !std::memcmp(header->magic, "CLCB", 4) && header->version == bundle_version &&
+                 header->bucket_count != 0 && !(header->bucket_count & (header->bucket_count - 1)) &&
+                 header->entry_count < header->bucket_count;
+    if (valid)
+    {
+        index_end = entries_offset(header->bucket_count) + sizeof(bundle_entry) * uint64_t(header->entry_count);
+        valid = index_end <= header->strings_offset && header->strings_offset + header->strings_size <= m_size;
+    }
+    if (!valid)
+    {
+        logerr("\"%s\" is not a valid bundle\n", fn);
+        close();
+        return false;
+    }
+
+    m_header = header;
+    m_buckets = reinterpret_cast<const uint32_t *>(m_data + sizeof(bundle_header));
+    m_entries = reinterpret_cast<const bundle_entry *>(m_data + entries_offset(header->bucket_count));
+
+    for (uint32_t i = 0; i < header->entry_count; ++i)
+    {
+        const bundle_entry &e = m_entries[i];
+        if (uint64_t(e.name_offset) + e.name_size > header->strings_size ||
+            uint64_t(e.device_offset) + e.device_size > header->strings_size || e.data_offset > m_size ||
+            e.data_size > m_size - e.data_offset)
+        {
+            logerr("\"%s\" is not a valid bundle\n", fn);
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::string bundle::string(uint32_t offset, uint32_t size) const
+{
+    return std::string(reinterpret_cast<const char *>(m_data + m_header->strings_offset + offset), size);
+}
+
+std::string bundle::name(size_t i) const
+{
+    return string(m_entries[i].name_offset, m_entries[i].name_size);
+}
+
+std::string bundle::identity(size_t i) const
+{
+    return string(m_entries[i].device_offset, m_entries[i].device_size);
+}
+
+const unsigned char *bundle::find(const std::string &name, const std::string &identity, size_t &size) const
+{
+    if (!m_header)
+    {
+        return nullptr;
+    }
+
+    const uint64_t key = bundle_key(name, identity);
+    const uint32_t mask = m_header->bucket_count - 1;
+    uint32_t b = static_cast<uint32_t>(key) & mask;
+    for (uint32_t probes = 0; probes < m_header->bucket_count && m_buckets[b]; ++probes, b = (b + 1) & mask)
+    {
+        uint32_t i = m_buckets[b] - 1;
+        if (i >= m_header->entry_count)
+        {
+            return nullptr;
+        }
+
+        const bundle_entry &e = m_entries[i];
+        if (e.key != key || e.name_size != name.size() || e.device_size != identity.size())
+        {
+            continue;
+        }
+
+        const char *strings = reinterpret_cast<const char *>(m_data + m_header->strings_offset);
+        if (!name.compare(0, name.size(), strings + e.name_offset, e.name_size) &&
+            !identity.compare(0, identity.size(), strings + e.device_offset, e.device_size))
+        {
+            size = static_cast<size_t>(e.data_size);
+            return m_data + e.data_offset;
+        }
+    }
+
+    return nullptr;
+}
+
+} // namespace clc
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef bundle_h
+#define bundle_h
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clc
+{
+
+/** Fat binary bundle file layout
+ *
+ * A bundle packs the binaries of many programs built for many devices into a single file meant to be mapped in
+ * memory. All fields are little endian, offsets are relative to the start of the file:
+ *
+ *     bundle_header
+ *     uint32_t buckets[bucket_count]   hash table of 1-based entry indices, 0 marks an empty bucket
+ *     bundle_entry entries[entry_count]
+ *     char strings[strings_size]       program names and device identities, not zero terminated
+ *     binaries                         each aligned on bundle_alignment bytes
+ *
+ * Entries are looked up by hashing the program name and the device identity (see @ref bundle_key), the hash table
+ * uses linear probing and is at most half full, a lookup touches a handful of buckets whatever the bundle size.
+ */
+struct bundle_header
+{
+    /** "CLCB" */
+    char magic[4];
+
+    /** format version, @ref bundle_version */
+    uint32_t version;
+
+    /** number of entries */
+    uint32_t entry_count;
+
+    /** number of hash table buckets, a power of two */
+    uint32_t bucket_count;
+
+    /** offset of the string table */
+    uint64_t strings_offset;
+
+    /** size of the string table in bytes */
+    uint64_t strings_size;
+};
+
+/** Bundle index entry */
+struct bundle_entry
+{
+    /** lookup key, see @ref bundle_key */
+    uint64_t key;
+
+    /** program name offset in the string table */
+    uint32_t name_offset;
+
+    /** program name length */
+    uint32_t name_size;
+
+    /** device identity offset in the string table */
+    uint32_t device_offset;
+
+    /** device identity length */
+    uint32_t device_size;
+
+    /** binary offset in the file */
+    uint64_t data_offset;
+
+    /** binary size in bytes */
+    uint64_t data_size;
+};
+
+/** Current bundle format version */
+const uint32_t bundle_version = 1;
+
+/** Alignment of the binaries within a bundle */
+const uint64_t bundle_alignment = 64;
+
+/** Device identity of the entries holding a kernel map rather than a binary, see @ref kernel_map_data
+ *
+ * When the kernels of a program are built in other programs, split or coalesced, the entry named after the program maps
+ * each kernel to the program holding it.
+ */
+const char *const kernel_map_identity = "clcompile:kernel-map";
+
+/** Serializes a kernel map as text lines of tab separated <kernel> <program name> fields
+ * @param[in] map Program name of each kernel, keyed by kernel name
+ * @return The entry data
+ */
+std::vector<unsigned char> kernel_map_data(const std::map<std::string, std::string> &map);
+
+/** Parses a kernel map, see @ref kernel_map_data
+ * @param[in] data Entry data
+ * @param[in] size Entry data size
+ * @return The program name of each kernel, keyed by kernel name
+ */
+std::map<std::string, std::string> parse_kernel_map(const unsigned char *data, size_t size);
+
+/** Computes the lookup key of a bundle entry
+ * @param[in] name Program name
+ * @param[in] identity Device identity, see @ref device_identity
+ * @return The lookup key
+ */
+uint64_t bundle_key(const std::string &name, const std::string &identity);
+
+/** Bundle writer, accumulates binaries then writes them out at once */
+class bundle_writer
+{
+  public:
+    /** Adds a binary, replacing any binary previously added for the same program and device
+     * @param[in] name Program name
+     * @param[in] identity Device identity
+     * @param[in] binary Program binary
+     */
+    void add(const std::string &name, const std::string &identity, std::vector<unsigned char> binary);
+
+    /** Finds a binary previously added
+     * @param[in] name Program name
+     * @param[in] identity Device identity
+     * @param[out] binary Receives a copy of the binary
+     * @return true if found, false otherwise
+     */
+    bool find(const std::string &name, const std::string &identity, std::vector<unsigned char> &binary) const;
+
+    /** Writes the bundle
+     * @param[in] fn Bundle filename
+     * @return true if succeeded, false otherwise
+     */
+    bool write(const char *fn) const;
+
+  private:
+    /** Accumulated binary */
+    struct item
+    {
+        std::string name;
+        std::string identity;
+        std::vector<unsigned char> binary;
+    };
+
+    /** accumulated binaries */
+    std::vector<item> m_items;
+
+    /** index of the accumulated binaries by program name and device identity */
+    std::map<std::pair<std::string, std::string>, size_t> m_index;
+};
+
+/** Read only view over a bundle file mapped in memory */
+class bundle
+{
+  public:
+    bundle() = default;
+    ~bundle();
+
+    bundle(const bundle &) = delete;
+    bundle &operator=(const bundle &) = delete;
+
+    /** Maps a bundle file and validates its index
+     * @param[in] fn Bundle filename
+     * @return true if succeeded, false otherwise
+     */
+    bool open(const char *fn);
+
+    /** Looks a binary up
+     *
+     * @param[in] name Program name
+     * @param[in] identity Device identity
+     * @param[out] size Receives the binary size
+     * @return A pointer to the binary within the mapping, nullptr if not found
+     */
+    const unsigned char *find(const std::string &name, const std::string &identity, size_t &size) const;
+
+    /** @return The number of entries */
+    size_t size() const
+    {
+        return m_header ? m_header->entry_count : 0;
+    }
+
+    /** @return The program name of entry @p i */
+    std::string name(size_t i) const;
+
+    /** @return The device identity of entry @p i */
+    std::string identity(size_t i) const;
+
+  private:
+    /** Releases the mapping */
+    void close();
+
+    /** @return The string at @p offset of the string table */
+    std::string string(uint32_t offset, uint32_t size) const;
+
+    /** mapped file */
+    const unsigned char *m_data = nullptr;
+
+    /** mapped file size */
+    size_t m_size = 0;
+
+    /** true if @ref m_data was mapped, false if allocated */
+    bool m_mapped = false;
+
+    /** header within the mapping */
+    const bundle_header *m_header = nullptr;
+
+    /** hash table within the mapping */
+    const uint32_t *m_buckets = nullptr;
+
+    /** entries within the mapping */
+    const bundle_entry *m_entries = nullptr;
+};
+
+} // namespace clc
+
+#endif // bundle_h
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "cache.h"
+#include "file.h"
+#include "hash.h"
+#include "log.h"
+#include "scope_guard.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace clc
+{
+
+std::string binary_cache::default_dir()
+{
+    const char *dir = std::getenv("CLCOMPILE_CACHE_DIR");
+    return dir ? dir : "";
+}
+
+bool binary_cache::open(const std::string &dir)
+{
+    if (dir.empty() || !make_dirs(dir))
+    {
+        logerr("could not create the cache directory \"%s\"\n", dir.c_str());
+        return false;
+    }
+    m_dir = dir;
+    return true;
+}
+
+uint64_t binary_cache::key(const std::string &identity, const std::string &options, const char *source)
+{
+    uint64_t h = fnv1a64(identity);
+    h = fnv1a64(options, h);
+    return fnv1a64(source, std::char_traits<char>::length(source), h);
+}
+
+std::string binary_cache::path(uint64_t key) const
+{
+    return m_dir + "/" + hash_str(key) + ".bin";
+}
+
+bool binary_cache::contains(uint64_t key) const
+{
+    struct stat st;
+    return stat(path(key).c_str(), &st) == 0 && st.st_size > 0;
+}
+
+bool binary_cache::load(uint64_t key, std::vector<unsigned char> &binary) const
+{
+    FILE *f = std::fopen(path(key).c_str(), "rb");
+    if (!f)
+    {
+        return false;
+    }
+    on_scope_guard([f]() { std::fclose(f); });
+
+    if (std::fseek(f, 0, SEEK_END) < 0)
+    {
+        return false;
+    }
+    long flen = std::ftell(f);
+    if (flen <= 0 || std::fseek(f, 0, SEEK_SET) < 0)
+    {
+        return false;
+    }
+
+    binary.resize(static_cast<size_t>(flen));
+    return std::fread(binary.data(), 1, binary.size(), f) == binary.size();
+}
+
+bool binary_cache::store(uint64_t key, const std::vector<unsigned char> &binary) const
+{
+    static std::atomic<unsigned> counter(0);
+
+    std::string final_path = path(key);
+    std::string tmp_path = final_path + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp";
+
+    FILE *f = std::fopen(tmp_path.c_str(), "wb");
+    if (!f)
+    {
+        logerr("could not create the cache entry \"%s\"\n", tmp_path.c_str());
+        return false;
+    }
+    bool written = std::fwrite(binary.data(), 1, binary.size(), f) == binary.size();
+    written = std::fclose(f) == 0 && written;
+
+    if (!written || std::rename(tmp_path.c_str(), final_path.c_str()) != 0)
+    {
+        logerr("could not write the cache entry \"%s\"\n", final_path.c_str());
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace clc
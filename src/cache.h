@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef cache_h
+#define cache_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** On-disk program binary cache
+ *
+ * Each binary is stored in its own file named after the hash of the device identity, the build options and the
+ * source text. Entries are written to a temporary file first and renamed in place, so concurrent writers and readers
+ * never observe a partial binary.
+ */
+class binary_cache
+{
+  public:
+    /** Returns the cache directory configured in the environment
+     * @return The value of CLCOMPILE_CACHE_DIR, empty if unset
+     */
+    static std::string default_dir();
+
+    /** Opens the cache, creating its directory if needed
+     * @param[in] dir Cache directory
+     * @return true if succeeded, false otherwise
+     */
+    bool open(const std::string &dir);
+
+    /** @return true if the cache was successfully opened */
+    bool is_open() const
+    {
+        return !m_dir.empty();
+    }
+
+    /** Computes the key of a program
+     *
+     * @param[in] identity Device identity, see @ref device_identity
+     * @param[in] options Build options
+     * @param[in] source Source text
+     * @return The cache key
+     */
+    static uint64_t key(const std::string &identity, const std::string &options, const char *source);
+
+    /** Checks whether a binary is present
+     * @param[in] key Cache key
+     * @return true if the binary was found, false otherwise
+     */
+    bool contains(uint64_t key) const;
+
+    /** Looks a binary up
+     * @param[in] key Cache key
+     * @param[out] binary Receives the binary on success
+     * @return true if the binary was found, false otherwise
+     */
+    bool load(uint64_t key, std::vector<unsigned char> &binary) const;
+
+    /** Stores a binary
+     * @param[in] key Cache key
+     * @param[in] binary Binary to store
+     * @return true if succeeded, false otherwise
+     */
+    bool store(uint64_t key, const std::vector<unsigned char> &binary) const;
+
+  private:
+    /** @return Path of the file holding the entry for @p key */
+    std::string path(uint64_t key) const;
+
+    /** cache directory, empty when the cache is not open */
+    std::string m_dir;
+};
+
+} // namespace clc
+
+#endif // cache_h
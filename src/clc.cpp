@@ -5,6 +5,7 @@
 #include "log.h"
 #include "scope_guard.h"
 
+#include <algorithm>
 #include <vector>
 
 namespace clc
@@ -98,6 +99,187 @@ const char *cl_error_str(cl_int errorcode)
 }
 #undef CL_ERRORCODE_STR
 
+namespace
+{
+
+/** Queries a string property through a clGet*Info style entry point
+ *
+ * @param[in] get_info Info entry point
+ * @param[in] object Object to query
+ * @param[in] param Property to query
+ * @return The property value, empty if the query failed
+ */
+template <typename T>
+std::string get_info_string(cl_int (*get_info)(T, cl_uint, size_t, void *, size_t *), T object, cl_uint param)
+{
+    size_t len;
+    if (get_info(object, param, 0, nullptr, &len) != CL_SUCCESS || len == 0)
+    {
+        return std::string();
+    }
+
+    std::vector<char> value(len);
+    if (get_info(object, param, len, value.data(), nullptr) != CL_SUCCESS)
+    {
+        return std::string();
+    }
+
+    return std::string(value.data());
+}
+
+} // namespace
+
+std::string device_identity(cl_device_id device)
+{
+    cl_platform_id platform;
+    if (clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr) != CL_SUCCESS)
+    {
+        return std::string();
+    }
+
+    std::string identity = get_info_string(clGetPlatformInfo, platform, CL_PLATFORM_NAME);
+    identity += '|';
+    identity += get_info_string(clGetDeviceInfo, device, CL_DEVICE_NAME);
+    identity += '|';
+    identity += get_info_string(clGetDeviceInfo, device, CL_DRIVER_VERSION);
+    return identity;
+}
+
+std::vector<std::string> get_kernel_names(cl_program program)
+{
+    std::vector<std::string> names;
+    std::string list = get_info_string(clGetProgramInfo, program, CL_PROGRAM_KERNEL_NAMES);
+    size_t start = 0;
+    while (start < list.size())
+    {
+        size_t end = list.find(';', start);
+        if (end == std::string::npos)
+        {
+            end = list.size();
+        }
+        if (end > start)
+        {
+            names.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return names;
+}
+
+bool get_device_limits(cl_device_id device, device_limits &limits)
+{
+    cl_int err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(limits.compute_units),
+                                 &limits.compute_units, nullptr);
+    if (err == CL_SUCCESS)
+    {
+        err = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(limits.local_mem), &limits.local_mem, nullptr);
+    }
+    if (err == CL_SUCCESS)
+    {
+        err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(limits.max_work_group_size),
+                              &limits.max_work_group_size, nullptr);
+    }
+    if (err != CL_SUCCESS)
+    {
+        logerr("could not retrieve the device limits (err=%s)\n", cl_error_str(err));
+        return false;
+    }
+    return true;
+}
+
+void estimate_occupancy(const device_limits &device, kernel_resources &kernel)
+{
+    size_t group = std::max<size_t>(kernel.preferred_multiple, 1);
+    size_t capacity = std::max(device.max_work_group_size, group);
+
+    kernel.compute_units = device.compute_units;
+    kernel.limiter = "work_items";
+    kernel.work_groups_per_cu = capacity / group;
+    if (kernel.work_group_size && kernel.work_group_size < capacity)
+    {
+        kernel.limiter = "private_mem";
+        kernel.work_groups_per_cu = std::max<size_t>(kernel.work_group_size / group, 1);
+    }
+    if (kernel.local_mem && device.local_mem / kernel.local_mem < kernel.work_groups_per_cu)
+    {
+        kernel.limiter = "local_mem";
+        kernel.work_groups_per_cu = static_cast<size_t>(device.local_mem / kernel.local_mem);
+    }
+    kernel.occupancy = static_cast<double>(kernel.work_groups_per_cu * group) / capacity;
+}
+
+bool get_kernel_resources(cl_program program, cl_device_id device, std::vector<kernel_resources> &kernels)
+{
+    kernels.clear();
+    device_limits limits;
+    if (!get_device_limits(device, limits))
+    {
+        return false;
+    }
+
+    for (const std::string &name : get_kernel_names(program))
+    {
+        cl_int err;
+        cl_kernel kernel = clCreateKernel(program, name.c_str(), &err);
+        if (err != CL_SUCCESS)
+        {
+            logerr("failed creating kernel \"%s\" (err=%s)\n", name.c_str(), cl_error_str(err));
+            return false;
+        }
+        on_scope_guard([kernel]() { clReleaseKernel(kernel); });
+
+        kernel_resources k;
+        k.name = name;
+        err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(k.local_mem), &k.local_mem,
+                                       nullptr);
+        if (err == CL_SUCCESS)
+        {
+            err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(k.private_mem),
+                                           &k.private_mem, nullptr);
+        }
+        if (err == CL_SUCCESS)
+        {
+            err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(k.work_group_size),
+                                           &k.work_group_size, nullptr);
+        }
+        if (err == CL_SUCCESS)
+        {
+            err = clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                           sizeof(k.preferred_multiple), &k.preferred_multiple, nullptr);
+        }
+        if (err != CL_SUCCESS)
+        {
+            logerr("failed querying the resources of kernel \"%s\" (err=%s)\n", name.c_str(), cl_error_str(err));
+            return false;
+        }
+        estimate_occupancy(limits, k);
+        kernels.push_back(k);
+    }
+    return true;
+}
+
+bool get_program_binary(cl_program program, std::vector<unsigned char> &binary)
+{
+    size_t size;
+    cl_int err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr);
+    if (err != CL_SUCCESS)
+    {
+        logerr("could not retrieve the program binary size (err=%s)\n", cl_error_str(err));
+        return false;
+    }
+
+    binary.resize(size);
+    unsigned char *data = binary.data();
+    err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr);
+    if (err != CL_SUCCESS)
+    {
+        logerr("could not retrieve the program binary (err=%s)\n", cl_error_str(err));
+        return false;
+    }
+
+    return true;
+}
+
 compiler::~compiler()
 {
     if (m_context)
@@ -179,7 +361,7 @@ bool compiler::init(cl_uint platform_id, cl_uint device_id)
         return false;
     }
 
-    loginfo("found device % s\n ", name.data());
+    loginfo("found device %s\n", name.data());
 
     cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
     if (err != CL_SUCCESS)
@@ -192,28 +374,66 @@ bool compiler::init(cl_uint platform_id, cl_uint device_id)
     m_platform = platforms[platform_id];
     m_device = devices[device_id];
     m_context = context;
+    m_identity = device_identity(m_device);
 
     return true;
 }
 
-bool compiler::build(const char *src)
+bool compiler::inspect(const std::vector<unsigned char> &binary, const char *options,
+                       std::vector<kernel_resources> &kernels) const
 {
+    const unsigned char *data = binary.data();
+    size_t size = binary.size();
+    cl_int status;
     cl_int err;
+    cl_program program = clCreateProgramWithBinary(m_context, 1, &m_device, &size, &data, &status, &err);
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed creating program from its binary (err=%s)\n", cl_error_str(err));
+        return false;
+    }
+    on_scope_guard([&program]() { clReleaseProgram(program); });
 
-    cl_program program = clCreateProgramWithSource(m_context, 1, (const char **)&src, nullptr, &err);
+    err = clBuildProgram(program, 1, &m_device, options, nullptr, nullptr);
     if (err != CL_SUCCESS)
     {
-        logerr("failed creating program (err=%s)", cl_error_str(err));
+        logerr("failed building program from its binary (err=%s)\n", cl_error_str(err));
         return false;
     }
+    return get_kernel_resources(program, m_device, kernels);
+}
 
+bool compiler::build(const char *src, const char *options, std::vector<unsigned char> *binary) const
+{
+    cl_program program = build_program(src, options);
+    if (!program)
+    {
+        return false;
+    }
     on_scope_guard([&program]() { clReleaseProgram(program); });
 
-    err = clBuildProgram(program, 1, &m_device, "", nullptr, nullptr);
+    return !binary || get_program_binary(program, *binary);
+}
+
+cl_program compiler::build_program(const char *src, const char *options) const
+{
+    cl_int err;
+
+    cl_program program = clCreateProgramWithSource(m_context, 1, (const char **)&src, nullptr, &err);
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed creating program (err=%s)", cl_error_str(err));
+        return nullptr;
+    }
+
+    on_scope_guard_named(failedBuild, [&program]() { clReleaseProgram(program); });
+
+    err = clBuildProgram(program, 1, &m_device, options, nullptr, nullptr);
     if (err == CL_SUCCESS)
     {
         loginfo("program built successfully.\n");
-        return true;
+        failedBuild.dismiss();
+        return program;
     }
     else
     {
@@ -229,7 +449,7 @@ bool compiler::build(const char *src)
         logerr("log length=%zd\nbuild log: \n%s\n", sz, log.data());
     }
 
-    return false;
+    return nullptr;
 }
 
 } // namespace clc
@@ -6,6 +6,9 @@
 
 #include <CL/cl.h>
 
+#include <string>
+#include <vector>
+
 namespace clc
 {
 
@@ -15,6 +18,108 @@ namespace clc
  */
 const char *cl_error_str(cl_int errorcode);
 
+/** Builds the identity string of a device
+ *
+ * Program binaries can only be reused on a device sharing the same identity: it combines the platform name, the device
+ * name and the driver version.
+ *
+ * @param[in] device Device to describe
+ * @return The identity string, empty if the device could not be queried
+ */
+std::string device_identity(cl_device_id device);
+
+/** Retrieves the binary of a program built for a single device
+ *
+ * @param[in] program Built program
+ * @param[out] binary Receives the program binary
+ * @return true if succeeded, false otherwise
+ */
+bool get_program_binary(cl_program program, std::vector<unsigned char> &binary);
+
+/** Lists the kernels of a built program
+ *
+ * @param[in] program Built program
+ * @return The kernel names, in the order the driver reports them, empty if the program could not be queried
+ */
+std::vector<std::string> get_kernel_names(cl_program program);
+
+/** Resources used by a kernel on a device */
+struct kernel_resources
+{
+    /** Kernel name */
+    std::string name;
+
+    /** Local memory in bytes, CL_KERNEL_LOCAL_MEM_SIZE */
+    cl_ulong local_mem = 0;
+
+    /** Private memory per work-item in bytes, CL_KERNEL_PRIVATE_MEM_SIZE */
+    cl_ulong private_mem = 0;
+
+    /** Maximum work-group size, CL_KERNEL_WORK_GROUP_SIZE */
+    size_t work_group_size = 0;
+
+    /** Preferred work-group size multiple, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE */
+    size_t preferred_multiple = 0;
+
+    /** Number of compute units of the device, CL_DEVICE_MAX_COMPUTE_UNITS */
+    cl_uint compute_units = 0;
+
+    /** Estimated number of concurrent work-groups per compute unit, see @ref estimate_occupancy */
+    size_t work_groups_per_cu = 0;
+
+    /** Estimated fraction of the work-items a compute unit can hold that the kernel keeps busy */
+    double occupancy = 0;
+
+    /** Resource limiting the concurrent work-groups: "work_items", "private_mem" or "local_mem" */
+    std::string limiter;
+};
+
+/** Device limits bounding the occupancy of a kernel */
+struct device_limits
+{
+    /** Number of compute units, CL_DEVICE_MAX_COMPUTE_UNITS */
+    cl_uint compute_units = 0;
+
+    /** Local memory per compute unit in bytes, CL_DEVICE_LOCAL_MEM_SIZE */
+    cl_ulong local_mem = 0;
+
+    /** Maximum work-group size, CL_DEVICE_MAX_WORK_GROUP_SIZE */
+    size_t max_work_group_size = 0;
+};
+
+/** Queries the limits of a device
+ * @param[in] device Device to query
+ * @param[out] limits Receives the device limits
+ * @return true if succeeded, false otherwise
+ */
+bool get_device_limits(cl_device_id device, device_limits &limits);
+
+/** Estimates the concurrent work-groups per compute unit of a kernel
+ *
+ * OpenCL exposes no register file or resident work-items capacity, so the estimate is a static heuristic for
+ * work-groups of the preferred work-group size multiple, a SIMD wavefront on most devices:
+ *
+ * - a compute unit is assumed to hold as many work-items as the device maximum work-group size,
+ * - a kernel maximum work-group size below the device one means its private memory (registers) is the limit, the
+ *   compute unit then holding that many of its work-items,
+ * - the local memory of a compute unit is shared among the work-groups running on it.
+ *
+ * The limiter is the resource allowing the fewest work-groups, the work-items taking precedence on ties.
+ *
+ * @param[in] device Device limits
+ * @param[in,out] kernel Kernel resources, receiving the estimate
+ */
+void estimate_occupancy(const device_limits &device, kernel_resources &kernel);
+
+/** Queries the resources used by the kernels of a built program, estimating their occupancy
+ *
+ * @param[in] program Built program
+ * @param[in] device Device the program was built for
+ * @param[out] kernels Receives the resources of each kernel, see @ref get_kernel_names
+ * @return true if succeeded, false otherwise
+ */
+bool get_kernel_resources(cl_program program, cl_device_id device, std::vector<kernel_resources> &kernels);
+
 /** compiler context */
 class compiler
 {
@@ -22,19 +127,58 @@ class compiler
     compiler() = default;
     ~compiler();
 
+    compiler(const compiler &) = delete;
+    compiler &operator=(const compiler &) = delete;
+
     /** Initialize an OpenCL context
      *
      * @param[in] platform_id Platform index to create the context for
-     * @param[in] platform_id Platform index to create the context for
+     * @param[in] device_id Device index to create the context for
      * @return true if succeeded, false otherwise
      */
     bool init(cl_uint platform_id, cl_uint device_id);
 
     /** Builds an OpenCL program
      * @param[in] src Source text
+     * @param[in] options Build options passed over to clBuildProgram
+     * @param[out] binary When not null, receives the program binary for the device
      * @return true if succeeded, false otherwise
      */
-    bool build(const char *src);
+    bool build(const char *src, const char *options = "", std::vector<unsigned char> *binary = nullptr) const;
+
+    /** Builds an OpenCL program and keeps it for further use
+     * @param[in] src Source text
+     * @param[in] options Build options passed over to clBuildProgram
+     * @return The built program, to be released with clReleaseProgram, nullptr if failed
+     */
+    cl_program build_program(const char *src, const char *options = "") const;
+
+    /** Queries the resources used by the kernels of a program binary
+     * @param[in] binary Program binary for the device
+     * @param[in] options Build options the binary was built with
+     * @param[out] kernels Receives the resources of each kernel, see @ref get_kernel_resources
+     * @return true if succeeded, false otherwise
+     */
+    bool inspect(const std::vector<unsigned char> &binary, const char *options,
+                 std::vector<kernel_resources> &kernels) const;
+
+    /** @return The OpenCL context */
+    cl_context context() const
+    {
+        return m_context;
+    }
+
+    /** @return The device in use */
+    cl_device_id device() const
+    {
+        return m_device;
+    }
+
+    /** @return The identity string of the device in use, see @ref device_identity */
+    const std::string &identity() const
+    {
+        return m_identity;
+    }
 
   private:
     /** platform in use */
@@ -45,6 +189,9 @@ class compiler
 
     /** opencl context */
     cl_context m_context = nullptr;
+
+    /** identity of the device in use */
+    std::string m_identity;
 };
 
 } // namespace clc
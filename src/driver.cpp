@@ -0,0 +1,609 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "driver.h"
+#include "cache.h"
+#include "clc.h"
+#include "file.h"
+#include "hash.h"
+#include "history.h"
+#include "log.h"
+#include "output.h"
+#include "parallel.h"
+#include "queue.h"
+#include "report.h"
+#include "source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace clc
+{
+
+std::vector<build_input> make_inputs(const std::vector<const char *> &filenames, const std::string &options)
+{
+    std::vector<build_input> inputs;
+    for (const char *fn : filenames)
+    {
+        build_input input;
+        input.filename = fn;
+        input.name = program_name(fn);
+        input.options = options;
+        inputs.push_back(std::move(input));
+    }
+    return inputs;
+}
+
+void print_stats(const build_stats &stats)
+{
+    std::printf("stats: builds=%zu cache_hits=%zu failed=%zu timed_out=%zu cancelled=%zu seconds=%.3f jobs=%u",
+                stats.builds, stats.cache_hits, stats.failed, stats.timed_out, stats.cancelled, stats.seconds,
+                stats.jobs);
+    if (stats.throughput > 0)
+    {
+        std::printf(" throughput=%.2f/s", stats.throughput);
+    }
+    std::printf(" load_bytes=%zu load_seconds=%.3f", stats.load_bytes, stats.load_seconds);
+    if (stats.load_seconds > 0)
+    {
+        std::printf(" load_throughput=%.2fMB/s", stats.load_bytes / stats.load_seconds / 1e6);
+    }
+    std::printf("\n");
+}
+
+build_stats build_inputs(const std::vector<std::unique_ptr<device_builder>> &builders,
+                         const std::vector<build_input> &inputs, const build_settings &settings)
+{
+    typedef std::shared_ptr<std::vector<unsigned char>> binary_ptr;
+    typedef std::shared_ptr<const std::string> source_ptr;
+
+    auto run_start = std::chrono::steady_clock::now();
+    const binary_cache *cache = settings.cache;
+    output_writer *output = settings.output;
+    build_history *history = settings.history;
+    kernel_report *report = settings.report;
+    size_t capacity = 2 * static_cast<size_t>(std::max(1u, settings.jobs));
+
+    /** Inputs sharing the same build options and normalized source text */
+    struct group
+    {
+        /** input the group was created for, set once, whose filename and options are the ones built */
+        size_t input = 0;
+
+        /** inputs of the group, appended to by the hasher under the mutex */
+        std::vector<size_t> members;
+        source_ptr source;
+        uint64_t hash = 0;
+
+        /** size of the source files of the group input as read, see @ref build_history */
+        size_t size = 0;
+
+        /** second hash and length of the normalized text, confirming equal hashes without keeping the text */
+        uint64_t check = 0;
+        size_t length = 0;
+
+        /** builds still to run, the source is released once they are done */
+        size_t pending = 0;
+
+        /** writes queued and not written yet */
+        size_t writes = 0;
+
+        /** binary for each builder once available, released once the builds are done and the binaries written */
+        std::vector<binary_ptr> binaries;
+
+        /** builders a binary was published for, the later members copy them from the output once released */
+        std::vector<bool> published;
+        bool released = false;
+    };
+
+    /** Source of an input, shared by the inputs of the same file, nullptr if it could not be loaded */
+    struct loaded
+    {
+        size_t input = 0;
+        source_ptr source;
+
+        /** size of the source files as read, before any transformation, see @ref build_history */
+        size_t size = 0;
+    };
+
+    struct build_item
+    {
+        group *g = nullptr;
+        size_t builder = 0;
+    };
+
+    /** Binary to write for an input, copied from the output of the group input when null */
+    struct write_item
+    {
+        group *g = nullptr;
+        size_t input = 0;
+        size_t builder = 0;
+        binary_ptr binary;
+    };
+
+    bounded_queue<loaded> read_queue(capacity);
+    bounded_queue<build_item> build_queue(capacity);
+    bounded_queue<write_item> write_queue(2 * capacity);
+
+    // groups are appended by the hasher while the builders and the writer refer to them
+    std::mutex mutex;
+    std::deque<group> groups;
+
+    size_t builds = 0;
+    std::atomic<size_t> failed(0);
+    std::atomic<size_t> timed_out(0);
+    std::atomic<size_t> cancelled(0);
+    std::atomic<size_t> cache_hits(0);
+    std::atomic<bool> stop(false);
+    auto fail = [&]() {
+        ++failed;
+        if (settings.fail_fast && !stop.exchange(true))
+        {
+            for (const auto &b : builders)
+            {
+                b->cancel();
+            }
+        }
+    };
+
+    // releases the binaries of a group once no build nor write needs them anymore, called with the mutex held
+    auto release = [&](group &g) {
+        if (g.pending == 0 && g.writes == 0 && !g.released)
+        {
+            g.binaries.clear();
+            g.binaries.shrink_to_fit();
+            g.released = true;
+        }
+    };
+
+    // publishes the binary of a group for a builder, queueing a write for each member known so far
+    auto publish = [&](group &g, size_t builder, binary_ptr binary) {
+        std::vector<size_t> members;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            g.binaries[builder] = binary;
+            g.published[builder] = true;
+            members = g.members;
+            g.writes += members.size();
+        }
+        for (size_t i : members)
+        {
+            write_item w;
+            w.g = &g;
+            w.input = i;
+            w.builder = builder;
+            w.binary = binary;
+            write_queue.push(std::move(w));
+        }
+    };
+
+    // reports the kernels of a group as built by a builder
+    auto inspect = [&](group &g, size_t builder, const std::vector<unsigned char> &binary) {
+        const build_input &input = inputs[g.input];
+        std::vector<kernel_resources> kernels;
+        if (builders[builder]->inspect(binary, input.options, kernels))
+        {
+            report->add(input.name, builders[builder]->identity(), kernels);
+        }
+    };
+
+    // coalesced programs are described by their name and the files they combine
+    auto describe = [&](const build_input &input) -> std::string {
+        if (input.coalesced.empty())
+        {
+            return input.filename;
+        }
+        std::string description = input.name + " (" + input.filename;
+        for (const std::string &fn : input.coalesced)
+        {
+            description += ", " + fn;
+        }
+        return description + ")";
+    };
+
+    auto done = [&](group &g) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--g.pending == 0)
+        {
+            g.source.reset();
+        }
+        release(g);
+    };
+
+    // reader, longest predicted build first
+    size_t load_bytes = 0;
+    double load_seconds = 0;
+    std::thread reader([&]() {
+        std::vector<size_t> order(inputs.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        if (history)
+        {
+            std::vector<double> cost(inputs.size());
+            for (size_t i = 0; i < inputs.size(); ++i)
+            {
+                size_t size = file_size(inputs[i].filename.c_str());
+                for (const std::string &fn : inputs[i].coalesced)
+                {
+                    size += file_size(fn.c_str());
+                }
+                cost[i] = history->predict(inputs[i].name, inputs[i].options, size);
+            }
+            std::stable_sort(order.begin(), order.end(), [&cost](size_t a, size_t b) { return cost[a] > cost[b]; });
+        }
+
+        // the inputs of the same file, such as its variants, share one loaded copy until the last one is read
+        struct shared_source
+        {
+            source_ptr source;
+            size_t remaining = 0;
+            bool loaded = false;
+        };
+        std::map<std::string, shared_source> shared;
+        for (const build_input &input : inputs)
+        {
+            ++shared[input.filename].remaining;
+        }
+
+        // batched so that the loads of many small files share their syscalls, see load_files
+        const size_t batch = 64;
+        std::vector<const char *> fns;
+        std::vector<shared_source *> targets;
+        std::vector<char *> sources;
+        for (size_t first = 0; first < order.size() && !stop; first += batch)
+        {
+            size_t last = std::min(first + batch, order.size());
+            fns.clear();
+            targets.clear();
+            for (size_t n = first; n < last; ++n)
+            {
+                shared_source &s = shared[inputs[order[n]].filename];
+                if (!s.loaded)
+                {
+                    s.loaded = true;
+                    fns.push_back(inputs[order[n]].filename.c_str());
+                    targets.push_back(&s);
+                }
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            load_files(fns, sources);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            load_seconds += elapsed.count();
+            for (size_t n = 0; n < sources.size(); ++n)
+            {
+                if (sources[n])
+                {
+                    targets[n]->source = std::make_shared<const std::string>(sources[n]);
+                    load_bytes += targets[n]->source->size();
+                    delete[] sources[n];
+                }
+            }
+
+            for (size_t n = first; n < last; ++n)
+            {
+                auto s = shared.find(inputs[order[n]].filename);
+                loaded l;
+                l.input = order[n];
+                l.source = s->second.source;
+                l.size = l.source ? l.source->size() : 0;
+                if (l.source && !inputs[order[n]].coalesced.empty())
+                {
+                    // the other sources of a coalesced program are only read by it
+                    const build_input &input = inputs[order[n]];
+                    std::vector<std::string> filenames(1, input.filename);
+                    std::vector<std::string> texts(1, *l.source);
+                    std::vector<const char *> more_fns;
+                    for (const std::string &fn : input.coalesced)
+                    {
+                        more_fns.push_back(fn.c_str());
+                    }
+                    std::vector<char *> more;
+                    auto coalesce_start = std::chrono::steady_clock::now();
+                    load_files(more_fns, more);
+                    for (size_t m = 0; m < more.size(); ++m)
+                    {
+                        if (!more[m])
+                        {
+                            l.source = nullptr;
+                            continue;
+                        }
+                        filenames.push_back(input.coalesced[m]);
+                        texts.push_back(more[m]);
+                        load_bytes += texts.back().size();
+                        l.size += texts.back().size();
+                        delete[] more[m];
+                    }
+                    elapsed = std::chrono::steady_clock::now() - coalesce_start;
+                    load_seconds += elapsed.count();
+                    if (l.source)
+                    {
+                        l.source = std::make_shared<const std::string>(coalesce_sources(filenames, texts));
+                    }
+                }
+                if (l.source && !inputs[order[n]].kernels.empty())
+                {
+                    l.source = std::make_shared<const std::string>(
+                        extract_kernels(*l.source, inputs[order[n]].kernels));
+                }
+                if (l.source && !inputs[order[n]].work_group_sizes.empty())
+                {
+                    l.source = std::make_shared<const std::string>(
+                        specialize_source(*l.source, inputs[order[n]].work_group_sizes));
+                }
+                if (--s->second.remaining == 0)
+                {
+                    shared.erase(s);
+                }
+                read_queue.push(std::move(l));
+            }
+        }
+        read_queue.close();
+    });
+
+    // hasher, grouping the duplicates and looking the binaries up in the cache
+    std::thread hasher([&]() {
+        std::multimap<uint64_t, group *> index;
+        source_ptr last_source;
+        std::string last_normalized;
+        loaded l;
+        while (read_queue.pop(l))
+        {
+            // after a failure in fail fast mode the inputs still queued are only drained, unblocking the reader
+            if (stop)
+            {
+                continue;
+            }
+
+            const build_input &input = inputs[l.input];
+            if (!l.source)
+            {
+                fail();
+                continue;
+            }
+
+            // the variants of a source follow each other, it is normalized once for all of them
+            if (l.source != last_source)
+            {
+                last_source = l.source;
+                last_normalized = normalize_source(*l.source);
+            }
+            const std::string &normalized = last_normalized;
+            uint64_t hash = fnv1a64(normalized, fnv1a64(input.options));
+
+            // equal hashes are confirmed by a second hash of the normalized text, seeded differently
+            uint64_t check = fnv1a64(normalized, ~fnv1a64_init);
+            group *primary = nullptr;
+            auto range = index.equal_range(hash);
+            for (auto p = range.first; p != range.second; ++p)
+            {
+                const build_input &other = inputs[p->second->input];
+                if (other.options == input.options && other.builders == input.builders &&
+                    p->second->check == check && p->second->length == normalized.size())
+                {
+                    primary = p->second;
+                    break;
+                }
+            }
+
+            if (primary)
+            {
+                loginfo("\"%s\" is identical to \"%s\", building it once\n", describe(input).c_str(),
+                        describe(inputs[primary->input]).c_str());
+
+                // the binaries already published are written here, the later ones by their builder
+                std::vector<write_item> writes;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    primary->members.push_back(l.input);
+                    for (size_t b = 0; b < builders.size(); ++b)
+                    {
+                        if (primary->published[b])
+                        {
+                            write_item w;
+                            w.g = primary;
+                            w.input = l.input;
+                            w.builder = b;
+                            if (!primary->released)
+                            {
+                                w.binary = primary->binaries[b];
+                            }
+                            writes.push_back(std::move(w));
+                        }
+                    }
+                    primary->writes += writes.size();
+                }
+                for (auto &w : writes)
+                {
+                    write_queue.push(std::move(w));
+                }
+                continue;
+            }
+
+            group *g;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                groups.emplace_back();
+                g = &groups.back();
+                g->input = l.input;
+                g->members.push_back(l.input);
+                g->source = l.source;
+                g->hash = hash;
+                g->size = l.size;
+                g->check = check;
+                g->length = normalized.size();
+                g->pending = input.builders.empty() ? builders.size() : input.builders.size();
+                g->binaries.resize(builders.size());
+                g->published.resize(builders.size());
+            }
+            index.insert(std::make_pair(hash, g));
+            builds += g->pending;
+
+            for (size_t b = 0; b < builders.size(); ++b)
+            {
+                if (!input.builders.empty() &&
+                    std::find(input.builders.begin(), input.builders.end(), b) == input.builders.end())
+                {
+                    continue;
+                }
+                if (cache && !stop)
+                {
+                    uint64_t key = binary_cache::key(builders[b]->identity(), input.options, l.source->c_str());
+                    binary_ptr binary(new std::vector<unsigned char>());
+                    if (output || report ? cache->load(key, *binary) : cache->contains(key))
+                    {
+                        loginfo("\"%s\" found in the binary cache.\n", describe(input).c_str());
+                        ++cache_hits;
+                        if (report)
+                        {
+                            inspect(*g, b, *binary);
+                        }
+                        if (output)
+                        {
+                            publish(*g, b, binary);
+                        }
+                        done(*g);
+                        continue;
+                    }
+                }
+
+                build_item item;
+                item.g = g;
+                item.builder = b;
+                build_queue.push(item);
+            }
+        }
+        build_queue.close();
+    });
+
+    // writer
+    std::thread writer([&]() {
+        write_item w;
+        while (write_queue.pop(w))
+        {
+            // a binary missing from the output fails the run like a failed build
+            const std::string &identity = builders[w.builder]->identity();
+            bool written = w.binary ? output->add(inputs[w.input].name, identity, *w.binary)
+                                    : output->copy(inputs[w.g->input].name, inputs[w.input].name, identity);
+            w.binary.reset();
+            if (!written)
+            {
+                fail();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            --w.g->writes;
+            release(*w.g);
+        }
+    });
+
+    // builders
+    auto build = [&]() {
+        build_item item;
+        if (!build_queue.pop(item))
+        {
+            return false;
+        }
+
+        group &g = *item.g;
+        if (stop)
+        {
+            ++cancelled;
+            done(g);
+            return true;
+        }
+
+        std::string description = describe(inputs[g.input]);
+        const std::string &options = inputs[g.input].options;
+        device_builder &b = *builders[item.builder];
+        auto start = std::chrono::steady_clock::now();
+        binary_ptr binary;
+        if (cache || output || report)
+        {
+            binary.reset(new std::vector<unsigned char>());
+        }
+
+        build_result result = b.build(*g.source, options, binary.get());
+        if (result == build_result::cancelled)
+        {
+            ++cancelled;
+        }
+        else if (result != build_result::success)
+        {
+            if (result == build_result::timed_out)
+            {
+                logerr("\"%s\" timed out\n", description.c_str());
+                ++timed_out;
+            }
+            else if (options.empty())
+            {
+                logerr("failed building \"%s\"\n", description.c_str());
+            }
+            else
+            {
+                logerr("failed building \"%s\" with options \"%s\"\n", description.c_str(), options.c_str());
+            }
+            fail();
+        }
+        else
+        {
+            if (history)
+            {
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                history->record(inputs[g.input].name, options, elapsed.count(), g.size);
+            }
+            if (cache)
+            {
+                cache->store(binary_cache::key(b.identity(), options, g.source->c_str()), *binary);
+            }
+            if (report)
+            {
+                inspect(g, item.builder, *binary);
+            }
+            if (output)
+            {
+                publish(g, item.builder, binary);
+            }
+        }
+        done(g);
+        return true;
+    };
+
+    build_stats stats;
+    if (settings.adaptive_jobs)
+    {
+        adaptive_result adaptive = adaptive_run(settings.jobs, build);
+        stats.jobs = adaptive.jobs;
+        stats.throughput = adaptive.throughput;
+    }
+    else
+    {
+        run_workers(settings.jobs, build);
+        stats.jobs = settings.jobs;
+    }
+
+    reader.join();
+    hasher.join();
+    write_queue.close();
+    writer.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - run_start;
+    stats.seconds = elapsed.count();
+    stats.builds = builds;
+    stats.failed = failed;
+    stats.timed_out = timed_out;
+    stats.cancelled = cancelled;
+    stats.cache_hits = cache_hits;
+    stats.load_bytes = load_bytes;
+    stats.load_seconds = load_seconds;
+    return stats;
+}
+
+} // namespace clc
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef driver_h
+#define driver_h
+
+#include "clc.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+class binary_cache;
+class build_history;
+class kernel_report;
+class output_writer;
+
+/** Outcome of a build */
+enum class build_result
+{
+    /** the program was built */
+    success,
+
+    /** the program failed to build */
+    failed,
+
+    /** the build did not complete within the allotted time */
+    timed_out,
+
+    /** the build was cancelled, see @ref device_builder::cancel */
+    cancelled,
+};
+
+/** Builds programs for one device */
+class device_builder
+{
+  public:
+    virtual ~device_builder() = default;
+
+    /** @return The identity of the device, see @ref device_identity */
+    virtual const std::string &identity() const = 0;
+
+    /** Builds a program, safe to call concurrently
+     *
+     * @param[in] source Source text
+     * @param[in] options Build options
+     * @param[out] binary When not null, receives the program binary
+     * @return The build outcome
+     */
+    virtual build_result build(const std::string &source, const std::string &options,
+                               std::vector<unsigned char> *binary) = 0;
+
+    /** Queries the resources used by the kernels of a binary built by this builder, safe to call concurrently
+     *
+     * @param[in] binary Program binary
+     * @param[in] options Build options the binary was built with
+     * @param[out] kernels Receives the resources of each kernel
+     * @return true if succeeded, false otherwise
+     */
+    virtual bool inspect(const std::vector<unsigned char> &binary, const std::string &options,
+                         std::vector<kernel_resources> &kernels) = 0;
+
+    /** Cancels the builds in flight where possible, safe to call concurrently with @ref build */
+    virtual void cancel()
+    {
+    }
+};
+
+/** Builds programs within the clcompile process */
+class compiler_builder : public device_builder
+{
+  public:
+    /** Initializes the OpenCL context, see @ref compiler::init
+     * @param[in] platform_id Platform index
+     * @param[in] device_id Device index
+     * @return true if succeeded, false otherwise
+     */
+    bool init(cl_uint platform_id, cl_uint device_id)
+    {
+        return m_compiler.init(platform_id, device_id);
+    }
+
+    const std::string &identity() const override
+    {
+        return m_compiler.identity();
+    }
+
+    build_result build(const std::string &source, const std::string &options,
+                       std::vector<unsigned char> *binary) override
+    {
+        return m_compiler.build(source.c_str(), options.c_str(), binary) ? build_result::success
+                                                                          : build_result::failed;
+    }
+
+    bool inspect(const std::vector<unsigned char> &binary, const std::string &options,
+                 std::vector<kernel_resources> &kernels) override
+    {
+        return m_compiler.inspect(binary, options.c_str(), kernels);
+    }
+
+  private:
+    /** compiler context */
+    compiler m_compiler;
+};
+
+/** Program to build */
+struct build_input
+{
+    /** Source filename */
+    std::string filename;
+
+    /** Program name, see @ref program_name */
+    std::string name;
+
+    /** Build options */
+    std::string options;
+
+    /** Indices of the builders to build the input with, empty for every builder */
+    std::vector<size_t> builders;
+
+    /** Source filenames concatenated after @ref filename into a single program, see @ref coalesce_sources */
+    std::vector<std::string> coalesced;
+
+    /** Kernels to keep along with the helper functions they depend on, empty to keep every kernel, see
+     * @ref extract_kernels */
+    std::set<std::string> kernels;
+
+    /** Work-group sizes the kernels are specialized for, keyed by kernel name, empty to build the source as is, see
+     * @ref specialize_source */
+    std::map<std::string, std::vector<size_t>> work_group_sizes;
+};
+
+/** Build settings shared by all inputs */
+struct build_settings
+{
+    /** Maximum number of concurrent builds */
+    unsigned jobs = 1;
+
+    /** Adapt the number of concurrent builds to the achieved throughput, see @ref adaptive_run */
+    bool adaptive_jobs = false;
+
+    /** Stop at the first failure, dropping the pending builds and cancelling the ones in flight, the sources not read
+     * or hashed yet are skipped */
+    bool fail_fast = false;
+
+    /** Binary cache, nullptr for no caching */
+    const binary_cache *cache = nullptr;
+
+    /** Output, nullptr for no output */
+    output_writer *output = nullptr;
+
+    /** Compile durations of previous runs, updated with the durations of this run, nullptr for no history */
+    build_history *history = nullptr;
+
+    /** Report receiving the resources used by the kernels of every built program, nullptr for no report */
+    kernel_report *report = nullptr;
+};
+
+/** Build statistics */
+struct build_stats
+{
+    /** Number of builds, one per unique input and device it targets */
+    size_t builds = 0;
+
+    /** Number of builds served by the binary cache */
+    size_t cache_hits = 0;
+
+    /** Number of failed builds, timed out ones and binaries that could not be written to the output included */
+    size_t failed = 0;
+
+    /** Number of timed out builds */
+    size_t timed_out = 0;
+
+    /** Number of builds dropped or cancelled after a failure in fail fast mode */
+    size_t cancelled = 0;
+
+    /** Wall clock duration in seconds */
+    double seconds = 0;
+
+    /** Concurrency level the builds ran at */
+    unsigned jobs = 1;
+
+    /** Builds per second measured at that level by the adaptive scheduling, 0 if not measured */
+    double throughput = 0;
+
+    /** Number of source bytes loaded */
+    size_t load_bytes = 0;
+
+    /** Time spent loading the sources in seconds, see @ref load_files */
+    double load_seconds = 0;
+};
+
+/** Prints build statistics to stdout
+ * @param[in] stats Statistics to print
+ */
+void print_stats(const build_stats &stats);
+
+/** Creates the build inputs of source files
+ *
+ * @param[in] filenames Source filenames
+ * @param[in] options Build options applied to every input
+ * @return The build inputs, named after the filenames
+ */
+std::vector<build_input> make_inputs(const std::vector<const char *> &filenames, const std::string &options);
+
+/** Builds every input for every device, writing the resulting binaries to the output
+ *
+ * The builds run as a pipeline of stages connected by bounded queues, so that reading and hashing the upcoming
+ * sources overlaps with the builds of the current ones:
+ *
+ * - a reader loads the sources in batches, longest predicted build first when a history is available,
+ * - a hasher groups the inputs sharing the same build options, builder and normalized source text (see
+ *   @ref normalize_source) so that each unique program is built once, and looks the binaries up in the cache,
+ * - builder threads build the programs missing from the cache for each device,
+ * - a writer writes the binaries to the output, once for each input of a group.
+ *
+ * @param[in] builders Builders of the targeted devices
+ * @param[in] inputs Inputs to build
+ * @param[in] settings Build settings
+ * @return The build statistics
+ */
+build_stats build_inputs(const std::vector<std::unique_ptr<device_builder>> &builders,
+                         const std::vector<build_input> &inputs, const build_settings &settings);
+
+} // namespace clc
+
+#endif // driver_h
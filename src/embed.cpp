@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "embed.h"
+#include "log.h"
+
+#include <cctype>
+#include <cstdio>
+#include <set>
+
+namespace clc
+{
+
+namespace
+{
+
+/** C++ keywords and alternative tokens, up to C++20 */
+const char *const cxx_keywords[] = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+    "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr", "constinit",
+    "const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double",
+    "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+    "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return", "short", "signed",
+    "sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+    "true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+    "wchar_t", "while", "xor", "xor_eq",
+};
+
+/** Turns a string into a valid C++ identifier, usable at namespace scope
+ *
+ * Runs of underscores are collapsed and leading or trailing ones are dropped since identifiers starting with an
+ * underscore or containing a double underscore are reserved. Identifiers that would start with a digit or be a keyword
+ * are prefixed with "clc_", empty ones become "clc".
+ *
+ * @param[in] s String to convert
+ * @return The identifier
+ */
+std::string identifier(const std::string &s)
+{
+    std::string id;
+    for (char c : s)
+    {
+        char i = std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+        if (i != '_' || (!id.empty() && id.back() != '_'))
+        {
+            id += i;
+        }
+    }
+    if (!id.empty() && id.back() == '_')
+    {
+        id.pop_back();
+    }
+
+    bool keyword = false;
+    for (const char *k : cxx_keywords)
+    {
+        keyword = keyword || id == k;
+    }
+    if (id.empty())
+    {
+        id = "clc";
+    }
+    else if (std::isdigit(static_cast<unsigned char>(id[0])) || keyword)
+    {
+        id.insert(0, "clc_");
+    }
+    return id;
+}
+
+/** Quotes a string as a C++ string literal, which can also be written in comments as it holds printable characters only
+ * and cannot end with a backslash
+ * @param[in] s String to quote
+ * @return The string literal
+ */
+std::string literal(const std::string &s)
+{
+    std::string l = "\"";
+    for (char c : s)
+    {
+        // question marks are escaped so that no trigraph, such as a line splicing ??/, can form
+        if (c == '"' || c == '\\' || c == '?')
+        {
+            l += '\\';
+            l += c;
+        }
+        else if (std::isprint(static_cast<unsigned char>(c)))
+        {
+            l += c;
+        }
+        else
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\%03o", static_cast<unsigned char>(c));
+            l += escaped;
+        }
+    }
+    return l + "\"";
+}
+
+/** Writes a whole string to a file
+ * @param[in] fn Filename
+ * @param[in] content Content to write
+ * @return true if succeeded, false otherwise
+ */
+bool write_text(const std::string &fn, const std::string &content)
+{
+    FILE *f = std::fopen(fn.c_str(), "wb");
+    if (!f)
+    {
+        logerr("failed creating the output file \"%s\"\n", fn.c_str());
+        return false;
+    }
+    bool written = std::fwrite(content.data(), 1, content.size(), f) == content.size();
+    if (std::fclose(f) != 0 || !written)
+    {
+        logerr("failed writing the output file \"%s\"\n", fn.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+void cxx_writer::add(const std::string &name, const std::string &identity, std::vector<unsigned char> binary)
+{
+    m_binaries[std::make_pair(name, identity)] = std::move(binary);
+}
+
+bool cxx_writer::find(const std::string &name, const std::string &identity, std::vector<unsigned char> &binary) const
+{
+    auto found = m_binaries.find(std::make_pair(name, identity));
+    if (found == m_binaries.end())
+    {
+        return false;
+    }
+    binary = found->second;
+    return true;
+}
+
+bool cxx_writer::write(const std::string &path) const
+{
+    size_t slash = path.find_last_of('/');
+    std::string base = slash == std::string::npos ? path : path.substr(slash + 1);
+    std::string ns = identifier(base);
+
+    std::set<std::string> names;
+    for (const auto &b : m_binaries)
+    {
+        names.insert(b.first.first);
+    }
+
+    std::string guard = ns + "_h";
+    std::string h = "// Generated by clcompile, do not edit\n"
+                    "\n"
+                    "#ifndef " +
+                    guard + "\n#define " + guard +
+                    "\n"
+                    "\n"
+                    "#include <cstddef>\n"
+                    "\n"
+                    "namespace " +
+                    ns +
+                    "\n"
+                    "{\n"
+                    "\n"
+                    "/** Program binary built for one device */\n"
+                    "struct binary\n"
+                    "{\n"
+                    "    const char *program;\n"
+                    "    const char *device;\n"
+                    "    const unsigned char *data;\n"
+                    "    std::size_t size;\n"
+                    "};\n"
+                    "\n"
+                    "/** Names of the embedded programs, a single nullptr when there are none */\n"
+                    "constexpr const char *program_names[] = {\n";
+    for (const auto &n : names)
+    {
+        h += "    " + literal(n) + ",\n";
+    }
+    if (names.empty())
+    {
+        h += "    nullptr,\n";
+    }
+    h += "};\n"
+         "\n"
+         "/** Number of embedded programs */\n"
+         "constexpr std::size_t program_count = " +
+         std::to_string(names.size()) +
+         ";\n"
+         "\n"
+         "/** Embedded binaries, sorted by program name then device identity */\n"
+         "extern const binary binaries[];\n"
+         "\n"
+         "/** Number of embedded binaries */\n"
+         "extern const std::size_t binary_count;\n"
+         "\n"
+         "/** Looks a binary up\n"
+         " * @param[in] program Program name\n"
+         " * @param[in] device Device identity\n"
+         " * @return The binary, nullptr if not found\n"
+         " */\n"
+         "const binary *find(const char *program, const char *device);\n"
+         "\n"
+         "} // namespace " +
+         ns +
+         "\n"
+         "\n"
+         "#endif // " +
+         guard + "\n";
+
+    std::string cpp = "// Generated by clcompile, do not edit\n"
+                      "\n"
+                      "#include \"" +
+                      base +
+                      ".h\"\n"
+                      "\n"
+                      "#include <cstring>\n"
+                      "\n"
+                      "namespace " +
+                      ns +
+                      "\n"
+                      "{\n"
+                      "\n"
+                      "namespace\n"
+                      "{\n";
+    size_t index = 0;
+    for (const auto &b : m_binaries)
+    {
+        cpp += "\n// " + literal(b.first.first) + " for " + literal(b.first.second) + "\n";
+        cpp += "alignas(64) const unsigned char binary" + std::to_string(index++) + "[] = {";
+        const std::vector<unsigned char> &data = b.second;
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            char byte[8];
+            std::snprintf(byte, sizeof(byte), "0x%02x,", data[i]);
+            cpp += (i % 16) ? " " : "\n    ";
+            cpp += byte;
+        }
+        // arrays cannot be empty, the size of the binary is written along with the array
+        cpp += data.empty() ? "\n    0x00,\n};\n" : "\n};\n";
+    }
+    cpp += "\n} // namespace\n"
+           "\n"
+           "const binary binaries[] = {\n";
+    index = 0;
+    for (const auto &b : m_binaries)
+    {
+        std::string array = "binary" + std::to_string(index++);
+        cpp += "    {" + literal(b.first.first) + ", " + literal(b.first.second) + ", " + array + ", " +
+               std::to_string(b.second.size()) + "},\n";
+    }
+    if (m_binaries.empty())
+    {
+        cpp += "    {nullptr, nullptr, nullptr, 0},\n";
+    }
+    cpp += "};\n"
+           "\n"
+           "const std::size_t binary_count = " +
+           std::to_string(m_binaries.size()) +
+           ";\n"
+           "\n"
+           "const binary *find(const char *program, const char *device)\n"
+           "{\n"
+           "    for (std::size_t i = 0; i < binary_count; ++i)\n"
+           "    {\n"
+           "        if (!std::strcmp(binaries[i].program, program) && !std::strcmp(binaries[i].device, device))\n"
+           "        {\n"
+           "            return &binaries[i];\n"
+           "        }\n"
+           "    }\n"
+           "    return nullptr;\n"
+           "}\n"
+           "\n"
+           "} // namespace " +
+           ns + "\n";
+
+    return write_text(path + ".h", h) && write_text(path + ".cpp", cpp);
+}
+
+} // namespace clc
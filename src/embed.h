@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef embed_h
+#define embed_h
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clc
+{
+
+/** C++ embedding writer, accumulates binaries then writes them out as a header/source pair
+ *
+ * The generated source holds the binaries as static byte arrays, so that they live in the read only pages of the
+ * executable linking it. The generated header declares them along with a compile time table of the program names,
+ * within a namespace named after the output basename.
+ */
+class cxx_writer
+{
+  public:
+    /** Adds a binary, replacing any binary previously added for the same program and device
+     * @param[in] name Program name
+     * @param[in] identity Device identity
+     * @param[in] binary Program binary
+     */
+    void add(const std::string &name, const std::string &identity, std::vector<unsigned char> binary);
+
+    /** Finds a binary previously added
+     * @param[in] name Program name
+     * @param[in] identity Device identity
+     * @param[out] binary Receives a copy of the binary
+     * @return true if found, false otherwise
+     */
+    bool find(const std::string &name, const std::string &identity, std::vector<unsigned char> &binary) const;
+
+    /** Writes the header/source pair
+     * @param[in] path Output path without extension, ".h" and ".cpp" get appended
+     * @return true if succeeded, false otherwise
+     */
+    bool write(const std::string &path) const;
+
+  private:
+    /** accumulated binaries keyed by program name and device identity, ordered for reproducible outputs */
+    std::map<std::pair<std::string, std::string>, std::vector<unsigned char>> m_binaries;
+};
+
+} // namespace clc
+
+#endif // embed_h
@@ -0,0 +1,507 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "file.h"
+#include "log.h"
+#include "scope_guard.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#ifdef CLCOMPILE_HAVE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace clc
+{
+
+#ifdef CLCOMPILE_HAVE_IO_URING
+namespace
+{
+
+/** Minimal io_uring submission and completion rings, no liburing dependency */
+class uring
+{
+  public:
+    uring() = default;
+    uring(const uring &) = delete;
+    uring &operator=(const uring &) = delete;
+
+    ~uring()
+    {
+        if (m_sqes)
+        {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_cq_ring && m_cq_ring != m_sq_ring)
+        {
+            munmap(m_cq_ring, m_cq_size);
+        }
+        if (m_sq_ring)
+        {
+            munmap(m_sq_ring, m_sq_size);
+        }
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    /** Sets the rings up
+     * @param[in] entries Number of submission queue entries
+     * @return true if succeeded, false if io_uring is unavailable
+     */
+    bool init(unsigned entries)
+    {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+        {
+            m_sq_size = m_cq_size = m_sq_size > m_cq_size ? m_sq_size : m_cq_size;
+        }
+        m_sq_ring = map(m_sq_size, IORING_OFF_SQ_RING);
+        m_cq_ring = single ? m_sq_ring : map(m_cq_size, IORING_OFF_CQ_RING);
+        m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = map(m_sqes_size, IORING_OFF_SQES);
+        if (!m_sq_ring || !m_cq_ring || !sqes)
+        {
+            return false;
+        }
+        m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+        char *sq = static_cast<char *>(m_sq_ring);
+        m_sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        m_sq_entries = p.sq_entries;
+        m_tail = *m_sq_tail;
+
+        char *cq = static_cast<char *>(m_cq_ring);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    /** @return The number of submission queue entries */
+    unsigned entries() const
+    {
+        return m_sq_entries;
+    }
+
+    /** @return true if operations were submitted and not completed, which may still use the buffers of the caller */
+    bool busy() const
+    {
+        return m_in_flight != 0;
+    }
+
+    /** Queues an operation, submitted by the next @ref wait
+     * @param[in] opcode Operation
+     * @param[in] user_data Value identifying the operation in its completion
+     * @return The entry to fill in, nullptr if the submission queue is full
+     */
+    io_uring_sqe *queue(__u8 opcode, __u64 user_data)
+    {
+        unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_tail - head >= m_sq_entries)
+        {
+            return nullptr;
+        }
+        unsigned index = m_tail & m_sq_mask;
+        io_uring_sqe *sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->user_data = user_data;
+        m_sq_array[index] = index;
+        ++m_tail;
+        ++m_unsubmitted;
+        return sqe;
+    }
+
+    /** Submits the queued operations and waits for all of them to complete
+     *
+     * When the submission fails, the operations already submitted are still waited for, as they may use the buffers of
+     * the caller, see @ref busy. The ring is left with the operations it could not submit and is not reusable.
+     *
+     * @param[in] fn Called with the user data and result of each completion
+     * @return true if succeeded, false if the submission or the wait failed
+     */
+    template <typename F> bool wait(const F &fn)
+    {
+        __atomic_store_n(m_sq_tail, m_tail, __ATOMIC_RELEASE);
+        bool submitted = true;
+        while (m_unsubmitted && submitted)
+        {
+            int ret = enter(m_unsubmitted);
+            if (ret < 0)
+            {
+                submitted = errno == EINTR;
+                continue;
+            }
+            unsigned count = static_cast<unsigned>(ret) < m_unsubmitted ? static_cast<unsigned>(ret) : m_unsubmitted;
+            m_unsubmitted -= count;
+            m_in_flight += count;
+            reap(fn);
+        }
+        while (m_in_flight)
+        {
+            if (enter(0) < 0 && errno != EINTR)
+            {
+                return false;
+            }
+            reap(fn);
+        }
+        return submitted;
+    }
+
+  private:
+    /** Submits operations and waits for at least one completion
+     * @param[in] to_submit Number of operations to submit
+     * @return What io_uring_enter returns
+     */
+    int enter(unsigned to_submit)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, m_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+    }
+
+    /** Consumes the available completions
+     * @param[in] fn Called with the user data and result of each completion
+     */
+    template <typename F> void reap(const F &fn)
+    {
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe &cqe = m_cqes[head & m_cq_mask];
+            fn(cqe.user_data, cqe.res);
+            --m_in_flight;
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    void *map(size_t size, __u64 offset)
+    {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    /** ring file descriptor */
+    int m_fd = -1;
+
+    /** mapped rings and their sizes */
+    void *m_sq_ring = nullptr;
+    void *m_cq_ring = nullptr;
+    size_t m_sq_size = 0;
+    size_t m_cq_size = 0;
+    size_t m_sqes_size = 0;
+
+    /** submission queue */
+    io_uring_sqe *m_sqes = nullptr;
+    unsigned *m_sq_head = nullptr;
+    unsigned *m_sq_tail = nullptr;
+    unsigned *m_sq_array = nullptr;
+    unsigned m_sq_mask = 0;
+    unsigned m_sq_entries = 0;
+
+    /** local submission tail, published by @ref wait */
+    unsigned m_tail = 0;
+
+    /** operations queued and not submitted yet */
+    unsigned m_unsubmitted = 0;
+
+    /** operations submitted and not completed yet */
+    unsigned m_in_flight = 0;
+
+    /** completion queue */
+    io_uring_cqe *m_cqes = nullptr;
+    unsigned *m_cq_head = nullptr;
+    unsigned *m_cq_tail = nullptr;
+    unsigned m_cq_mask = 0;
+};
+
+/** Loads files through io_uring, leaving nullptr for the files to load with @ref load_file
+ * @param[in] fns Filenames to load
+ * @param[out] sources Receives the loaded sources
+ * @return false if io_uring is unavailable or failed
+ */
+bool uring_load_files(const std::vector<const char *> &fns, std::vector<char *> &sources)
+{
+    // the ring of the calling thread is set up by its first load and reused by the next ones
+    static thread_local std::unique_ptr<uring> ring;
+    static thread_local bool unavailable = false;
+    if (!ring && !unavailable)
+    {
+        ring.reset(new uring);
+        if (!ring->init(128))
+        {
+            ring.reset();
+            unavailable = true;
+        }
+    }
+    if (!ring)
+    {
+        return false;
+    }
+
+    // each file of a batch takes an open and a statx entry
+    size_t batch = ring->entries() / 2;
+    std::vector<int> fds(batch, -1);
+    std::vector<struct statx> stats(batch);
+    std::vector<int> results(batch);
+    size_t first = 0;
+    size_t count = 0;
+
+    // the files the ring did not close are closed here, whatever the exit path
+    on_scope_guard([&fds]() {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+    });
+
+    // the sources of the batch are only released once no read may still target them, a ring that failed is dropped
+    auto fail = [&]() {
+        bool busy = ring->busy();
+        ring.reset();
+        if (!busy)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                delete[] sources[first + i];
+                sources[first + i] = nullptr;
+            }
+        }
+        else
+        {
+            // the files may still be read or closed by the ring
+            logerr("io_uring operations could not be waited for, leaking their buffers\n");
+            for (size_t i = 0; i < count; ++i)
+            {
+                sources[first + i] = nullptr;
+            }
+            fds.assign(fds.size(), -1);
+        }
+        return false;
+    };
+
+    for (; first < fns.size(); first += batch)
+    {
+        count = fns.size() - first < batch ? fns.size() - first : batch;
+        auto failed = [&](size_t i) { return fds[i] < 0 || results[i] < 0; };
+
+        // open and query the size of every file of the batch
+        for (size_t i = 0; i < count; ++i)
+        {
+            io_uring_sqe *open = ring->queue(IORING_OP_OPENAT, 2 * i);
+            open->fd = AT_FDCWD;
+            open->addr = reinterpret_cast<__u64>(fns[first + i]);
+            open->open_flags = O_RDONLY | O_CLOEXEC;
+
+            io_uring_sqe *stat = ring->queue(IORING_OP_STATX, 2 * i + 1);
+            stat->fd = AT_FDCWD;
+            stat->addr = reinterpret_cast<__u64>(fns[first + i]);
+            stat->len = STATX_SIZE;
+            stat->off = reinterpret_cast<__u64>(&stats[i]);
+        }
+        bool ok = ring->wait([&](__u64 data, int res) {
+            if (data & 1)
+            {
+                results[data / 2] = res;
+            }
+            else
+            {
+                fds[data / 2] = res;
+            }
+        });
+        if (!ok)
+        {
+            return fail();
+        }
+
+        // read them whole
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (failed(i))
+            {
+                continue;
+            }
+            size_t size = static_cast<size_t>(stats[i].stx_size);
+            char *source = new char[size + 1];
+            source[size] = '\0';
+            sources[first + i] = source;
+
+            io_uring_sqe *read = ring->queue(IORING_OP_READ, i);
+            read->fd = fds[i];
+            read->addr = reinterpret_cast<__u64>(source);
+            read->len = static_cast<__u32>(size);
+        }
+        ok = ring->wait([&](__u64 data, int res) {
+            // short reads are left to load_file
+            if (res < 0 || static_cast<__u64>(res) != stats[data].stx_size)
+            {
+                delete[] sources[first + data];
+                sources[first + data] = nullptr;
+            }
+        });
+        if (!ok)
+        {
+            return fail();
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (fds[i] >= 0)
+            {
+                ring->queue(IORING_OP_CLOSE, i)->fd = fds[i];
+            }
+        }
+        ok = ring->wait([&](__u64 data, int) { fds[data] = -1; });
+        if (!ok)
+        {
+            return fail();
+        }
+    }
+    return true;
+}
+
+} // namespace
+#endif
+
+void load_files(const std::vector<const char *> &fns, std::vector<char *> &sources)
+{
+    sources.assign(fns.size(), nullptr);
+#ifdef CLCOMPILE_HAVE_IO_URING
+    const char *enabled = std::getenv("CLCOMPILE_IO_URING");
+    if (!enabled || std::strcmp(enabled, "0") != 0)
+    {
+        uring_load_files(fns, sources);
+    }
+#endif
+    for (size_t i = 0; i < fns.size(); ++i)
+    {
+        if (!sources[i])
+        {
+            sources[i] = load_file(fns[i]);
+        }
+    }
+}
+
+char *load_file(const char *fn)
+{
+    FILE *f = std::fopen(fn, "rb");
+    if (!f)
+    {
+        logerr("failed opening the file \"%s\"\n", fn);
+        return nullptr;
+    }
+    on_scope_guard([f]() { fclose(f); });
+
+    if (fseek(f, 0, SEEK_END) < 0)
+    {
+        logerr("could not seek to the end of the file \"%s\"\n", fn);
+        return nullptr;
+    };
+
+    long flen = ftell(f);
+    if (flen < 0)
+    {
+        logerr("failed determining the size of the file \"%s\"\n", fn);
+        return nullptr;
+    }
+    if (fseek(f, 0, SEEK_SET) < 0)
+    {
+        logerr("could not seek back to the beginning of the file \"%s\"\n", fn);
+        return nullptr;
+    };
+
+    char *source = new char[flen + 1];
+    if (!source)
+    {
+        logerr("failed allocating memory for reading source file \"%s\"\n", fn);
+        return nullptr;
+    }
+    on_scope_guard_named(failedRead, [source]() { delete[] source; });
+
+    if (std::fread(source, 1, flen, f) != static_cast<size_t>(flen))
+    {
+        logerr("failed reading the source file \"%s\"'s content\n", fn);
+        return nullptr;
+    }
+    source[flen] = '\0';
+
+    failedRead.dismiss();
+
+    return source;
+}
+
+size_t file_size(const char *fn)
+{
+    struct stat st;
+    return stat(fn, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+std::vector<std::string> split_fields(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;)
+    {
+        size_t end = line.find('\t', start);
+        fields.push_back(line.substr(start, end - start));
+        if (end == std::string::npos)
+        {
+            break;
+        }
+        start = end + 1;
+    }
+    return fields;
+}
+
+bool make_dirs(const std::string &dir)
+{
+    for (size_t pos = 1; pos <= dir.size(); ++pos)
+    {
+        if (pos != dir.size() && dir[pos] != '/')
+        {
+            continue;
+        }
+        std::string sub = dir.substr(0, pos);
+#ifdef _WIN32
+        int ret = _mkdir(sub.c_str());
+#else
+        int ret = mkdir(sub.c_str(), 0755);
+#endif
+        if (ret != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace clc
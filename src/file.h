@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef file_h
+#define file_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Loads the content from a file
+ *
+ * @param[in] fn filename to load
+ *
+ * @return nullptr if failed, or a valid pointer to a zero terminated c string
+ * containing the file's contents, to be released with delete[]
+ */
+char *load_file(const char *fn);
+
+/** Loads the content of many files
+ *
+ * On Linux, the opens, size queries, reads and closes of the files are submitted to io_uring in batches, which saves
+ * most of the syscalls and lets the kernel overlap the I/O of cold files. It falls back to @ref load_file for the
+ * files it could not load that way, and for all of them where io_uring is unavailable or disabled by setting the
+ * CLCOMPILE_IO_URING environment variable to 0.
+ *
+ * @param[in] fns Filenames to load
+ * @param[out] sources Receives for each file what @ref load_file would return for it
+ */
+void load_files(const std::vector<const char *> &fns, std::vector<char *> &sources);
+
+/** Returns the size of a file
+ * @param[in] fn Filename
+ * @return The file size in bytes, 0 if it cannot be determined
+ */
+size_t file_size(const char *fn);
+
+/** Splits a line of a text file into its tab separated fields
+ * @param[in] line Line to split
+ * @return The fields, at least one
+ */
+std::vector<std::string> split_fields(const std::string &line);
+
+/** Creates a directory and its missing parents
+ * @param[in] dir Directory to create
+ * @return true if the directory exists on return, false otherwise
+ */
+bool make_dirs(const std::string &dir);
+
+} // namespace clc
+
+#endif // file_h
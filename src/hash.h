@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef hash_h
+#define hash_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace clc
+{
+
+/** FNV-1a offset basis, the initial value of a hash */
+const uint64_t fnv1a64_init = 0xcbf29ce484222325ULL;
+
+/** Hashes a memory block with the 64 bits FNV-1a function
+ *
+ * @param[in] data Memory block to hash
+ * @param[in] size Size of the memory block in bytes
+ * @param[in] h Hash value to continue from, allows hashing discontiguous data
+ * @return The updated hash value
+ */
+inline uint64_t fnv1a64(const void *data, size_t size, uint64_t h = fnv1a64_init)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/** Hashes a string including its terminating zero, so that consecutive strings hash unambiguously
+ *
+ * @param[in] s String to hash
+ * @param[in] h Hash value to continue from
+ * @return The updated hash value
+ */
+inline uint64_t fnv1a64(const std::string &s, uint64_t h = fnv1a64_init)
+{
+    return fnv1a64(s.c_str(), s.size() + 1, h);
+}
+
+/** Formats a hash value as a 16 characters hexadecimal string
+ * @param[in] h Hash value
+ * @return The hexadecimal representation
+ */
+inline std::string hash_str(uint64_t h)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string s(16, '0');
+    for (int i = 15; i >= 0; --i, h >>= 4)
+    {
+        s[i] = digits[h & 0xf];
+    }
+    return s;
+}
+
+} // namespace clc
+
+#endif // hash_h
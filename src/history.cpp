@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "history.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+namespace clc
+{
+
+bool build_history::load(const std::string &fn)
+{
+    std::ifstream in(fn);
+    if (!in)
+    {
+        return true;
+    }
+
+    std::vector<double> rates;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        // <seconds>\t<size>\t<name>\t<options>, the lines of older histories failing to parse
+        char *end;
+        entry e;
+        e.seconds = std::strtod(line.c_str(), &end);
+        if (*end != '\t')
+        {
+            continue;
+        }
+        e.size = std::strtoull(end + 1, &end, 10);
+        if (*end != '\t' || e.seconds < 0)
+        {
+            continue;
+        }
+
+        std::string name(end + 1);
+        size_t tab = name.find('\t');
+        std::string options = tab == std::string::npos ? std::string() : name.substr(tab + 1);
+        m_entries[std::make_pair(name.substr(0, tab), options)] = e;
+        if (e.size)
+        {
+            rates.push_back(e.seconds / e.size);
+        }
+    }
+
+    if (!rates.empty())
+    {
+        std::nth_element(rates.begin(), rates.begin() + rates.size() / 2, rates.end());
+        m_rate = rates[rates.size() / 2];
+    }
+    return true;
+}
+
+bool build_history::save(const std::string &fn) const
+{
+    std::string tmp_fn = fn + ".tmp";
+    FILE *f = std::fopen(tmp_fn.c_str(), "w");
+    if (!f)
+    {
+        logerr("failed creating the build history \"%s\"\n", tmp_fn.c_str());
+        return false;
+    }
+
+    bool written = true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &e : m_entries)
+        {
+            written = written && std::fprintf(f, "%f\t%zu\t%s\t%s\n", e.second.seconds, e.second.size,
+                                              e.first.first.c_str(), e.first.second.c_str()) > 0;
+        }
+    }
+
+    if (std::fclose(f) != 0 || !written || std::rename(tmp_fn.c_str(), fn.c_str()) != 0)
+    {
+        logerr("failed writing the build history \"%s\"\n", fn.c_str());
+        std::remove(tmp_fn.c_str());
+        return false;
+    }
+    return true;
+}
+
+double build_history::predict(const std::string &name, const std::string &options, size_t size) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto found = m_entries.find(std::make_pair(name, options));
+    if (found != m_entries.end())
+    {
+        const entry &e = found->second;
+        return e.size ? e.seconds * size / e.size : e.seconds;
+    }
+
+    // with no history at all, the size alone still orders the sources
+    return size * (m_rate > 0 ? m_rate : 1e-6);
+}
+
+void build_history::record(const std::string &name, const std::string &options, double seconds, size_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // an older version of the program is stale
+    entry e;
+    e.seconds = seconds;
+    e.size = size;
+    m_entries[std::make_pair(name, options)] = e;
+}
+
+} // namespace clc
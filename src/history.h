@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef history_h
+#define history_h
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace clc
+{
+
+/** Compile durations recorded by previous runs, used to predict the cost of builds
+ *
+ * Durations are keyed by program name and build options, so that the variants, parts and combinations of a source
+ * file each keep their own, only the latest version of a program is kept. The file lists one build per line as tab
+ * separated fields:
+ *
+ *     <seconds><TAB><source size><TAB><program name><TAB><build options>
+ *
+ * Source sizes are the sizes of the source files of a program, before it gets split, coalesced or specialized, so that
+ * predictions made before reading the sources scale the durations by the same measure.
+ */
+class build_history
+{
+  public:
+    /** Loads the history, a missing file is an empty history
+     * @param[in] fn History filename
+     * @return true if succeeded, false otherwise
+     */
+    bool load(const std::string &fn);
+
+    /** Saves the history, previous entries not recorded again during this run are kept
+     * @param[in] fn History filename
+     * @return true if succeeded, false otherwise
+     */
+    bool save(const std::string &fn) const;
+
+    /** Predicts the compile duration of a source before reading it
+     *
+     * The duration recorded for the program is scaled by the change of the source size since, programs with no
+     * history are estimated from their size using the median compile rate of the recorded programs.
+     *
+     * @param[in] name Program name
+     * @param[in] options Build options
+     * @param[in] size Source size in bytes
+     * @return The predicted duration in seconds
+     */
+    double predict(const std::string &name, const std::string &options, size_t size) const;
+
+    /** Records a compile duration, replacing the one of a previous version of the program, safe to call concurrently
+     *
+     * @param[in] name Program name
+     * @param[in] options Build options
+     * @param[in] seconds Compile duration in seconds
+     * @param[in] size Source size in bytes
+     */
+    void record(const std::string &name, const std::string &options, double seconds, size_t size);
+
+  private:
+    /** Recorded build */
+    struct entry
+    {
+        /** compile duration in seconds */
+        double seconds;
+
+        /** source size in bytes */
+        size_t size;
+    };
+
+    /** recorded builds keyed by program name and build options */
+    std::map<std::pair<std::string, std::string>, entry> m_entries;
+
+    /** median compile rate of the loaded builds in seconds per byte, 0 if unknown */
+    double m_rate = 0;
+
+    /** serializes concurrent records */
+    mutable std::mutex m_mutex;
+};
+
+} // namespace clc
+
+#endif // history_h
@@ -0,0 +1,277 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "loader.h"
+#include "clc.h"
+#include "file.h"
+#include "log.h"
+#include "scope_guard.h"
+
+#include <vector>
+
+namespace clc
+{
+
+loader::~loader()
+{
+    for (auto &k : m_kernels)
+    {
+        clReleaseKernel(k.second);
+    }
+    for (auto &p : m_programs)
+    {
+        clReleaseProgram(p.second);
+    }
+    if (m_context)
+    {
+        clReleaseContext(m_context);
+    }
+}
+
+bool loader::open(const char *bundle_fn, cl_context context, cl_device_id device)
+{
+    if (m_context)
+    {
+        logerr("the loader is already open\n");
+        return false;
+    }
+
+    if (bundle_fn && !m_bundle.open(bundle_fn))
+    {
+        return false;
+    }
+
+    m_identity = device_identity(device);
+    if (m_identity.empty())
+    {
+        logerr("could not retrieve the device identity\n");
+        return false;
+    }
+
+    clRetainContext(context);
+    m_context = context;
+    m_device = device;
+    return true;
+}
+
+bool loader::set_fallback(const std::string &source_dir, const std::string &cache_dir, const std::string &options)
+{
+    m_source_dir = source_dir;
+    m_options = options;
+    return cache_dir.empty() || m_cache.open(cache_dir);
+}
+
+cl_program loader::create_from_binary(const unsigned char *binary, size_t size) const
+{
+    cl_int status;
+    cl_int err;
+    cl_program program = clCreateProgramWithBinary(m_context, 1, &m_device, &size, &binary, &status, &err);
+    if (err != CL_SUCCESS)
+    {
+        return nullptr;
+    }
+
+    err = clBuildProgram(program, 1, &m_device, m_options.c_str(), nullptr, nullptr);
+    if (err != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        return nullptr;
+    }
+    return program;
+}
+
+cl_program loader::create_from_source(const std::string &name) const
+{
+    if (m_source_dir.empty())
+    {
+        return nullptr;
+    }
+
+    std::string fn = m_source_dir + "/" + name + ".cl";
+    char *source = load_file(fn.c_str());
+    if (!source)
+    {
+        return nullptr;
+    }
+    on_scope_guard([source]() { delete[] source; });
+
+    std::vector<unsigned char> binary;
+    uint64_t key = binary_cache::key(m_identity, m_options, source);
+    if (m_cache.is_open() && m_cache.load(key, binary))
+    {
+        cl_program program = create_from_binary(binary.data(), binary.size());
+        if (program)
+        {
+            return program;
+        }
+    }
+
+    cl_int err;
+    cl_program program = clCreateProgramWithSource(m_context, 1, (const char **)&source, nullptr, &err);
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed creating program \"%s\" (err=%s)\n", name.c_str(), cl_error_str(err));
+        return nullptr;
+    }
+
+    err = clBuildProgram(program, 1, &m_device, m_options.c_str(), nullptr, nullptr);
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed building program \"%s\" (err=%s)\n", name.c_str(), cl_error_str(err));
+        clReleaseProgram(program);
+        return nullptr;
+    }
+
+    if (m_cache.is_open() && get_program_binary(program, binary))
+    {
+        m_cache.store(key, binary);
+    }
+
+    return program;
+}
+
+cl_program loader::program(const std::string &name)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_programs.find(name);
+        if (found != m_programs.end())
+        {
+            return found->second;
+        }
+    }
+
+    // programs are built without holding the lock, other programs can meanwhile be created or looked up
+    cl_program program = nullptr;
+    size_t size;
+    const unsigned char *binary = m_bundle.find(name, m_identity, size);
+    if (binary)
+    {
+        program = create_from_binary(binary, size);
+    }
+    if (!program)
+    {
+        program = create_from_source(name);
+    }
+    if (!program)
+    {
+        logerr("could not load program \"%s\"\n", name.c_str());
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto inserted = m_programs.insert(std::make_pair(name, program));
+    if (!inserted.second)
+    {
+        // another thread created the same program first, its program is the one handed out
+        clReleaseProgram(program);
+    }
+    return inserted.first->second;
+}
+
+std::string loader::kernel_program(const std::string &program_name, const std::string &kernel_name)
+{
+    std::map<std::string, std::map<std::string, std::string>>::const_iterator map;
+    bool parsed;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        map = m_kernel_maps.find(program_name);
+        parsed = map != m_kernel_maps.end();
+    }
+    if (!parsed)
+    {
+        size_t size;
+        const unsigned char *data = m_bundle.find(program_name, kernel_map_identity, size);
+        std::map<std::string, std::string> parsed = data ? parse_kernel_map(data, size)
+                                                         : std::map<std::string, std::string>();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        map = m_kernel_maps.emplace(program_name, std::move(parsed)).first;
+    }
+
+    // the maps are never modified once inserted, nor erased until destruction
+    auto found = map->second.find(kernel_name);
+    size_t size;
+    if (found == map->second.end() || !m_bundle.find(found->second, m_identity, size))
+    {
+        return program_name;
+    }
+    return found->second;
+}
+
+cl_kernel loader::kernel(const std::string &program_name, const std::string &kernel_name)
+{
+    auto key = std::make_pair(program_name, kernel_name);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_kernels.find(key);
+        if (found != m_kernels.end())
+        {
+            return found->second;
+        }
+    }
+
+    cl_program p = program(kernel_program(program_name, kernel_name));
+    if (!p)
+    {
+        return nullptr;
+    }
+
+    cl_int err;
+    cl_kernel k = clCreateKernel(p, kernel_name.c_str(), &err);
+    if (err != CL_SUCCESS)
+    {
+        logerr("failed creating kernel \"%s\" of program \"%s\" (err=%s)\n", kernel_name.c_str(),
+               program_name.c_str(), cl_error_str(err));
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto inserted = m_kernels.insert(std::make_pair(key, k));
+    if (!inserted.second)
+    {
+        // another thread created the same kernel first
+        clReleaseKernel(k);
+    }
+    return inserted.first->second;
+}
+
+bool loader::set_tuning_db(const std::string &fn)
+{
+    return m_tuning.load(fn);
+}
+
+bool loader::local_size(const std::string &program_name, const std::string &kernel_name, cl_uint dims,
+                        const size_t *global, size_t *local)
+{
+    auto key = std::make_pair(program_name, kernel_name);
+    uint64_t hash = 0;
+    bool known = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_kernel_hashes.find(key);
+        if (found != m_kernel_hashes.end())
+        {
+            hash = found->second;
+            known = true;
+        }
+    }
+
+    if (!known)
+    {
+        // the source is read and hashed without holding the lock, racing threads compute the same hash
+        std::string fn = m_source_dir + "/" + program_name + ".cl";
+        char *source = m_source_dir.empty() ? nullptr : load_file(fn.c_str());
+        if (source)
+        {
+            hash = kernel_hash(source, m_options, kernel_name);
+            delete[] source;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_kernel_hashes.insert(std::make_pair(key, hash));
+    }
+    return hash && m_tuning.find(hash, m_identity, dims, global, local);
+}
+
+} // namespace clc
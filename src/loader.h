@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef loader_h
+#define loader_h
+
+#include "bundle.h"
+#include "cache.h"
+#include "tuning.h"
+
+#include <CL/cl.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace clc
+{
+
+/** Runtime program loader
+ *
+ * Maps a bundle written by clcompile and hands out the programs and kernels built for one device, creating them on
+ * first use. Programs missing from the bundle, or whose bundled binary the driver rejects, fall back to the binary
+ * cache and finally to a source build whose binary is written back to the cache.
+ *
+ * The loader is safe to use from concurrent threads, the usual OpenCL rules apply to the returned kernels (e.g.
+ * clSetKernelArg must not be called concurrently on the same kernel).
+ */
+class loader
+{
+  public:
+    loader() = default;
+    ~loader();
+
+    loader(const loader &) = delete;
+    loader &operator=(const loader &) = delete;
+
+    /** Opens the loader
+     *
+     * @param[in] bundle_fn Bundle filename, nullptr to only rely on the source fallback
+     * @param[in] context Context to create the programs in, retained by the loader
+     * @param[in] device Device to create the programs for, must belong to @p context
+     * @return true if succeeded, false otherwise
+     */
+    bool open(const char *bundle_fn, cl_context context, cl_device_id device);
+
+    /** Configures the fallback used for programs the bundle cannot provide
+     *
+     * @param[in] source_dir Directory holding the program sources as "<program name>.cl"
+     * @param[in] cache_dir Binary cache directory, empty for no caching
+     * @param[in] options Build options for source builds, must match those the bundle was built with
+     * @return true if succeeded, false if the cache could not be opened
+     */
+    bool set_fallback(const std::string &source_dir, const std::string &cache_dir, const std::string &options);
+
+    /** Returns a program, creating it on first use
+     * @param[in] name Program name
+     * @return The built program owned by the loader, nullptr if failed
+     */
+    cl_program program(const std::string &name);
+
+    /** Returns a kernel, creating it and its program on first use
+     *
+     * When the program was split or coalesced by clcompile, the kernel comes from the bundled program holding it,
+     * see @ref kernel_map_identity, or from the original program when that one is not bundled for the device.
+     *
+     * @param[in] program_name Program name
+     * @param[in] kernel_name Kernel name
+     * @return The kernel owned by the loader, nullptr if failed
+     */
+    cl_kernel kernel(const std::string &program_name, const std::string &kernel_name);
+
+    /** Loads the tuning database the local sizes are looked up in
+     *
+     * Kernels are identified by hashing their source with the fallback build options, see @ref set_fallback.
+     *
+     * @param[in] fn Tuning database filename, written by clcompile --tune-work-groups
+     * @return true if succeeded, false otherwise
+     */
+    bool set_tuning_db(const std::string &fn);
+
+    /** Looks the tuned local size of a kernel up
+     *
+     * @param[in] program_name Program name
+     * @param[in] kernel_name Kernel name
+     * @param[in] dims Number of dimensions
+     * @param[in] global Global size
+     * @param[out] local Receives the local size
+     * @return true if found, false if the kernel was not tuned or its source is not available, in which case passing
+     *         a null local size to clEnqueueNDRangeKernel leaves the choice to the driver
+     */
+    bool local_size(const std::string &program_name, const std::string &kernel_name, cl_uint dims,
+                    const size_t *global, size_t *local);
+
+  private:
+    /** Creates a program from its binary and builds it
+     * @param[in] binary Program binary
+     * @param[in] size Binary size
+     * @return The built program, nullptr if failed
+     */
+    cl_program create_from_binary(const unsigned char *binary, size_t size) const;
+
+    /** Creates a program through the source fallback
+     * @param[in] name Program name
+     * @return The built program, nullptr if failed
+     */
+    cl_program create_from_source(const std::string &name) const;
+
+    /** Resolves the program holding a kernel, see @ref kernel
+     * @param[in] program_name Program name
+     * @param[in] kernel_name Kernel name
+     * @return The name of the program to create the kernel from
+     */
+    std::string kernel_program(const std::string &program_name, const std::string &kernel_name);
+
+    /** bundle providing the binaries */
+    bundle m_bundle;
+
+    /** context the programs are created in */
+    cl_context m_context = nullptr;
+
+    /** device the programs are created for */
+    cl_device_id m_device = nullptr;
+
+    /** device identity */
+    std::string m_identity;
+
+    /** fallback source directory, empty for no source fallback */
+    std::string m_source_dir;
+
+    /** fallback build options */
+    std::string m_options;
+
+    /** fallback binary cache */
+    binary_cache m_cache;
+
+    /** guards the maps below, programs and kernels are created without holding it and published once created */
+    std::mutex m_mutex;
+
+    /** programs created so far */
+    std::map<std::string, cl_program> m_programs;
+
+    /** kernel maps parsed so far, keyed by program name, empty for programs that were not split */
+    std::map<std::string, std::map<std::string, std::string>> m_kernel_maps;
+
+    /** kernels created so far, keyed by program and kernel names */
+    std::map<std::pair<std::string, std::string>, cl_kernel> m_kernels;
+
+    /** tuned local sizes */
+    tuning_db m_tuning;
+
+    /** kernel hashes computed so far, keyed by program and kernel names, 0 when the source is missing */
+    std::map<std::pair<std::string, std::string>, uint64_t> m_kernel_hashes;
+};
+
+} // namespace clc
+
+#endif // loader_h
@@ -1,70 +1,41 @@
 // SPDX-License-Identifier: MIT
 // Copyright 2023 Edouard Gomez
 
+#include "bench.h"
+#include "cache.h"
 #include "clc.h"
+#include "driver.h"
+#include "history.h"
 #include "log.h"
-#include "scope_guard.h"
+#include "manifest.h"
+#include "matrix.h"
+#include "output.h"
+#include "parallel.h"
+#include "prewarm.h"
+#include "report.h"
+#include "space.h"
+#include "split.h"
+#include "tune.h"
+#include "worker.h"
 
 #include <CL/cl.h>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace
 {
 
-/** Loads the content from a file
- *
- * @param[in] fn filename to load
- *
- * @return nullptr if failed, or a valid pointer to a zero terminated c string
- * containing the file's contents
- */
-char *load_file(const char *fn)
+/** @return The default recycling limits of the worker processes */
+clc::worker_limits default_worker_limits()
 {
-    FILE *f = std::fopen(fn, "r");
-    if (!f)
-    {
-        logerr("failed opening the file \"%s\"\n", fn);
-        return nullptr;
-    }
-    on_scope_guard([f]() { fclose(f); });
-
-    if (fseek(f, 0, SEEK_END) < 0)
-    {
-        logerr("could not seek to the end of the file \"%s\"\n", fn);
-        return nullptr;
-    };
-
-    long flen = ftell(f);
-    if (flen < 0)
-    {
-        logerr("failed determining the size of the file \"%s\"\n", fn);
-        return nullptr;
-    }
-    if (fseek(f, 0, SEEK_SET) < 0)
-    {
-        logerr("could not seek back to the beginning of the file \"%s\"\n", fn);
-        return nullptr;
-    };
-
-    char *source = new char[flen];
-    if (!source)
-    {
-        logerr("failed allocating memory for reading source file \"%s\"\n", fn);
-        return nullptr;
-    }
-    on_scope_guard_named(failedRead, [source]() { delete[] source; });
-
-    if (std::fread(source, 1, flen, f) != flen)
-    {
-        logerr("failed reading the source file \"%s\"'s content\n", fn);
-        return nullptr;
-    }
-
-    failedRead.dismiss();
-
-    return source;
+    clc::worker_limits limits;
+    limits.max_builds = 100;
+    limits.max_rss = size_t(4096) << 20;
+    return limits;
 }
 
 /** Program options structure */
@@ -73,25 +44,201 @@ struct clcompile_options
     /** Files to be compiled */
     std::vector<const char *> filenames;
 
-    /** Options to pass over to teh CL compiler */
+    /** Manifests listing programs to build */
+    std::vector<const char *> manifests;
+
+    /** Macro definitions every program is built with each combination of */
+    clc::define_matrix define_matrix;
+
+    /** Options to pass over to the CL compiler, ahead of the per program ones of the manifests */
     std::vector<const char *> clargs;
 
     /** CL Platform ID used for the compilation */
     cl_uint platform_id = 0;
 
-    /** CL Device used for the compilation */
-    cl_uint device_id = 0;
+    /** CL Devices used for the compilation, every program is built for each of them */
+    std::vector<cl_uint> device_ids;
+
+    /** Binary cache directory, empty for no caching */
+    std::string cache_dir = clc::binary_cache::default_dir();
+
+    /** Application trace to prewarm the binary cache from, nullptr when not prewarming */
+    const char *prewarm_trace = nullptr;
+
+    /** Output path, nullptr for no output */
+    const char *output = nullptr;
+
+    /** Output format */
+    clc::output_format format = clc::output_format::binary;
+
+    /** Build history file, empty to use the one of the binary cache */
+    std::string history;
+
+    /** Maximum number of concurrent builds */
+    unsigned jobs = clc::default_jobs();
+
+    /** Adapt the number of concurrent builds to the achieved throughput */
+    bool adaptive_jobs = false;
+
+    /** Print build statistics */
+    bool stats = false;
+
+    /** Print the resources used by the kernels of the built programs */
+    bool report = false;
+
+    /** Kernel report format */
+    clc::report_format report_format = clc::report_format::table;
+
+    /** Stop at the first build failure */
+    bool fail_fast = false;
+
+    /** Build in worker processes rather than within clcompile */
+    bool isolate = false;
+
+    /** Kernel specs to benchmark the programs with, nullptr when not benchmarking */
+    const char *bench_specs = nullptr;
+
+    /** Number of timed runs of each benchmarked kernel */
+    unsigned bench_runs = 10;
+
+    /** Search the fastest math options of each benchmarked kernel */
+    bool tune_options = false;
+
+    /** Maximum relative error of the tuned outputs against the reference build, negative for no check */
+    double tune_tolerance = -1;
+
+    /** Search the fastest local size of each benchmarked kernel */
+    bool tune_work_groups = false;
+
+    /** Tuning database file, empty to use the one of the binary cache */
+    std::string tuning_db;
+
+    /** Also build the programs specialized for the local sizes of the tuning database */
+    bool specialize = false;
+
+    /** Tunable macros whose fastest configuration is searched, empty when not tuning them */
+    clc::define_matrix tune_space;
+
+    /** Maximum number of configurations evaluated per program and device, 0 for no limit */
+    unsigned tune_budget = 0;
+
+    /** Parameter space tuning checkpoint, empty to use the one of the binary cache */
+    std::string tune_checkpoint;
+
+    /** Manifest receiving the best configurations, nullptr for none */
+    const char *tune_manifest = nullptr;
+
+    /** Build each kernel in isolation and print the build time of each */
+    bool attribute_build_times = false;
+
+    /** Maximum number of programs the kernels of each program are split into, 0 to build them as is */
+    unsigned split_programs = 0;
+
+    /** Maximum source size of the programs combining the small ones, 0 to build them as they are */
+    size_t coalesce_programs = 0;
+
+    /** Worker processes recycling limits */
+    clc::worker_limits worker_limits = default_worker_limits();
 };
 
+/** Joins command line arguments into a build options string
+ *
+ * @param[in] args Arguments, quoted when they contain whitespace
+ * @return The build options
+ */
+std::string join_options(const std::vector<const char *> &args)
+{
+    std::string options;
+    for (const char *a : args)
+    {
+        if (!options.empty())
+        {
+            options += ' ';
+        }
+        if (std::strpbrk(a, " \t") && !std::strchr(a, '"'))
+        {
+            options += '"';
+            options += a;
+            options += '"';
+        }
+        else
+        {
+            options += a;
+        }
+    }
+    return options;
+}
+
 /** Print the help message of the program to stdout */
 void print_help()
 {
     std::printf("usage: clcompile [OPTION...] <filename...> -- [CLOPTION...]\n"
+                "       clcompile [OPTION...] --manifest <MANIFEST> -- [CLOPTION...]\n"
+                "       clcompile [OPTION...] --prewarm <TRACE> -- [CLOPTION...]\n"
+                "       clcompile @<FILE>\n"
                 "\n"
                 "OPTIONS\n"
                 "\n"
                 "-p, --platform-id <INTEGER> Index of the platform to target\n"
-                "-d, --device-id   <INTEGER> Index of the device to target\n"
+                "-d, --device-id   <INTEGER> Index of the device to target, repeat to target several devices\n"
+                "-o, --output      <PATH>    Output directory, output file for the bundle format,\n"
+                "                            output file without extension for the cxx format\n"
+                "    --format      <FORMAT>  Output format: binary (default, one file per program and device),\n"
+                "                            bundle (a single file for all programs and devices)\n"
+                "                            or cxx (a C++ header/source pair embedding all programs and devices)\n"
+                "-j, --jobs        <INTEGER> Maximum number of concurrent builds\n"
+                "    --adaptive-jobs         Ramp the number of concurrent builds up to the one maximizing the\n"
+                "                            throughput, at most --jobs\n"
+                "    --stats                 Print build statistics\n"
+                "    --report      <FORMAT>  Print the local and private memory, maximum work-group size,\n"
+                "                            preferred work-group size multiple and estimated occupancy of every\n"
+                "                            kernel built: table or json\n"
+                "    --fail-fast             Stop at the first build failure, cancelling the remaining builds\n"
+                "    --isolate               Build in worker processes, a crashing build only fails itself\n"
+                "    --worker-max-builds <INTEGER>\n"
+                "                            Recycle worker processes after that many builds (default: 100)\n"
+                "    --worker-max-rss <MB>   Recycle worker processes using more memory (default: 4096)\n"
+                "    --timeout     <SECONDS> Kill the worker process of a build running longer, implies --isolate\n"
+                "    --cache-dir   <DIR>     Binary cache directory (default: $CLCOMPILE_CACHE_DIR)\n"
+                "    --history     <FILE>    Compile durations history used to start the longest builds first\n"
+                "                            (default: <cache directory>/history)\n"
+                "    --prewarm     <TRACE>   Build the programs listed in TRACE into the binary cache\n"
+                "    --manifest    <MANIFEST>\n"
+                "                            Build the programs listed in MANIFEST, one per line as tab separated\n"
+                "                            <source>[ <options>[ <program name>[ <device id>]]] fields\n"
+                "    --define-matrix <DEFINES>\n"
+                "                            Build every program once per combination of the macro values, eg:\n"
+                "                            \"-DTYPE={float,half} -DTILE={8,16,32}\" builds 6 variants named\n"
+                "                            <program name>.TYPE=float.TILE=8 and so on, may be repeated\n"
+                "    --bench-kernels <SPECS> Run the kernels of the programs as described by SPECS, one per line as\n"
+                "                            tab separated <kernel> <global size>[ <local size>[ <arguments>]]\n"
+                "                            fields, and print their execution time statistics instead of building\n"
+                "    --bench-runs  <INTEGER> Number of timed runs of each benchmarked kernel (default: 10)\n"
+                "    --tune-options          Search the fastest math options of each kernel run by --bench-kernels\n"
+                "    --tune-tolerance <REL>  Reject the math options changing the kernel outputs by more than REL,\n"
+                "                            relative to the outputs built without them\n"
+                "    --tune-work-groups      Search the fastest local size of each kernel run by --bench-kernels\n"
+                "    --tuning-db   <FILE>    Local sizes found by --tune-work-groups, for the runtime loader\n"
+                "                            (default: <cache directory>/tuning)\n"
+                "    --specialize            Also build the programs with tuned kernels with the reqd_work_group_size\n"
+                "                            of their local sizes, named <program name>.reqd\n"
+                "    --tune-space  <DEFINES> Search the fastest values of the tunable macros of the programs run by\n"
+                "                            --bench-kernels, given as for --define-matrix, may be repeated\n"
+                "    --tune-budget <INTEGER> Maximum number of configurations evaluated per program and device\n"
+                "    --tune-checkpoint <FILE>\n"
+                "                            Evaluations of --tune-space, resuming an interrupted tuning\n"
+                "                            (default: <cache directory>/checkpoint)\n"
+                "    --tune-manifest <MANIFEST>\n"
+                "                            Write the best configurations found by --tune-space as a manifest\n"
+                "    --kernel-build-times    Build every kernel of the programs alone, keeping the helper functions,\n"
+                "                            and print the build time and binary size of each instead of building\n"
+                "    --split-programs <INTEGER>\n"
+                "                            Split the kernels of every program into at most that many programs\n"
+                "                            named <program name>.part<index>, building concurrently\n"
+                "    --coalesce-programs <BYTES>\n"
+                "                            Build the programs smaller than BYTES concatenated into programs of\n"
+                "                            at most BYTES named coalesced.<index>, when their names do not conflict\n"
+                "    @<FILE>                 Read further arguments from FILE\n"
                 "\n"
                 "-h, --help                  Print this help message\n"
                 "-v, --version               Print the program's version\n"
@@ -110,6 +257,24 @@ void print_version()
     std::printf("0.1 (cl_target_opencl_version:%s)\n", CLC_STRINGIFY(CL_TARGET_OPENCL_VERSION));
 }
 
+/** Fetches the argument of the option at index @p i, advancing @p i past it
+ *
+ * @param[in] argc Number of arguments in the @ref argv argument array
+ * @param[in] argv Array of zero terminated strings
+ * @param[in,out] i Index of the option
+ *
+ * @return The option argument, nullptr if missing
+ */
+const char *option_arg(int argc, const char **argv, int &i)
+{
+    if (i >= argc - 1)
+    {
+        logerr("missing argument for option %s\n", argv[i]);
+        return nullptr;
+    }
+    return argv[++i];
+}
+
 /** Parse the program command line arguments
  *
  * @param[in] argc Number of arguments in the @ref argv argument array
@@ -136,25 +301,278 @@ int parse_args(int argc, const char **argv, bool &exit, clcompile_options &optio
     {
         if (!std::strcmp("--device-id", argv[i]) || !std::strcmp("-d", argv[i]))
         {
-            if (i < argc - 1)
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
             {
-                logerr("missing argument for option %s", argv[i]);
                 exit = true;
                 return EXIT_FAILURE;
             }
-            options.device_id = std::atoi(argv[i + 1]);
-            ++i;
+            options.device_ids.push_back(std::atoi(arg));
         }
-        else if (!strcmp("--platform-id", argv[i]) || !strcmp("-d", argv[i]))
+        else if (!strcmp("--platform-id", argv[i]) || !strcmp("-p", argv[i]))
         {
-            if (i < argc - 1)
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.platform_id = atoi(arg);
+        }
+        else if (!strcmp("--jobs", argv[i]) || !strcmp("-j", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atoi(arg) < 1)
+            {
+                logerr("invalid number of jobs\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.jobs = atoi(arg);
+        }
+        else if (!strcmp("--adaptive-jobs", argv[i]))
+        {
+            options.adaptive_jobs = true;
+        }
+        else if (!strcmp("--stats", argv[i]))
+        {
+            options.stats = true;
+        }
+        else if (!strcmp("--fail-fast", argv[i]))
+        {
+            options.fail_fast = true;
+        }
+        else if (!strcmp("--isolate", argv[i]))
+        {
+            options.isolate = true;
+        }
+        else if (!strcmp("--worker-max-builds", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.worker_limits.max_builds = atoi(arg);
+        }
+        else if (!strcmp("--worker-max-rss", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.worker_limits.max_rss = static_cast<size_t>(atoi(arg)) << 20;
+        }
+        else if (!strcmp("--timeout", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atof(arg) <= 0)
+            {
+                logerr("invalid timeout\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.worker_limits.timeout = atof(arg);
+            options.isolate = true;
+        }
+        else if (!strcmp("--output", argv[i]) || !strcmp("-o", argv[i]))
+        {
+            options.output = option_arg(argc, argv, i);
+            if (!options.output)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp("--format", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || !clc::parse_output_format(arg, options.format))
+            {
+                logerr("invalid output format\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp("--report", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || !clc::parse_report_format(arg, options.report_format))
+            {
+                logerr("invalid report format\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.report = true;
+        }
+        else if (!strcmp("--cache-dir", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.cache_dir = arg;
+        }
+        else if (!strcmp("--history", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.history = arg;
+        }
+        else if (!strcmp("--prewarm", argv[i]))
+        {
+            options.prewarm_trace = option_arg(argc, argv, i);
+            if (!options.prewarm_trace)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp("--manifest", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.manifests.push_back(arg);
+        }
+        else if (!strcmp("--define-matrix", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || !options.define_matrix.add(arg))
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp("--bench-kernels", argv[i]))
+        {
+            options.bench_specs = option_arg(argc, argv, i);
+            if (!options.bench_specs)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp("--bench-runs", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atoi(arg) < 1)
+            {
+                logerr("invalid number of benchmark runs\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.bench_runs = atoi(arg);
+        }
+        else if (!strcmp("--tune-options", argv[i]))
+        {
+            options.tune_options = true;
+        }
+        else if (!strcmp("--tune-tolerance", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atof(arg) < 0)
+            {
+                logerr("invalid tolerance\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.tune_tolerance = atof(arg);
+        }
+        else if (!strcmp("--tune-work-groups", argv[i]))
+        {
+            options.tune_work_groups = true;
+        }
+        else if (!strcmp("--tuning-db", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.tuning_db = arg;
+        }
+        else if (!strcmp("--specialize", argv[i]))
+        {
+            options.specialize = true;
+        }
+        else if (!strcmp("--kernel-build-times", argv[i]))
+        {
+            options.attribute_build_times = true;
+        }
+        else if (!strcmp("--split-programs", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atoi(arg) < 1)
+            {
+                logerr("invalid number of split programs\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.split_programs = atoi(arg);
+        }
+        else if (!strcmp("--coalesce-programs", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atoi(arg) < 1)
+            {
+                logerr("invalid coalesced program size\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.coalesce_programs = atoi(arg);
+        }
+        else if (!strcmp("--tune-space", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || !options.tune_space.add(arg))
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp("--tune-budget", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg || atoi(arg) < 1)
+            {
+                logerr("invalid tuning budget\n");
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.tune_budget = atoi(arg);
+        }
+        else if (!strcmp("--tune-checkpoint", argv[i]))
+        {
+            const char *arg = option_arg(argc, argv, i);
+            if (!arg)
+            {
+                exit = true;
+                return EXIT_FAILURE;
+            }
+            options.tune_checkpoint = arg;
+        }
+        else if (!strcmp("--tune-manifest", argv[i]))
+        {
+            options.tune_manifest = option_arg(argc, argv, i);
+            if (!options.tune_manifest)
             {
-                logerr("missing argument for option %s", argv[i]);
                 exit = true;
                 return EXIT_FAILURE;
             }
-            options.platform_id = atoi(argv[i + 1]);
-            ++i;
         }
         else if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i]))
         {
@@ -186,13 +604,27 @@ int parse_args(int argc, const char **argv, bool &exit, clcompile_options &optio
         ++i;
     }
 
-    if (options.filenames.size() == 0)
+    if (options.filenames.size() == 0 && options.manifests.empty() && !options.prewarm_trace)
     {
         print_help();
         exit = true;
         return EXIT_FAILURE;
     }
 
+    bool tuning = options.tune_options || options.tune_tolerance >= 0 || options.tune_work_groups ||
+                  !options.tune_space.empty();
+    if (tuning && !options.bench_specs)
+    {
+        logerr("tuning requires kernel specs, see --bench-kernels\n");
+        exit = true;
+        return EXIT_FAILURE;
+    }
+
+    if (options.device_ids.empty())
+    {
+        options.device_ids.push_back(0);
+    }
+
     exit = false;
     return EXIT_SUCCESS;
 }
@@ -201,32 +633,277 @@ int parse_args(int argc, const char **argv, bool &exit, clcompile_options &optio
 
 int main(int argc, const char **argv)
 {
+    if (argc == 4 && !std::strcmp(argv[1], "--worker"))
+    {
+        return clc::worker_main(std::atoi(argv[2]), std::atoi(argv[3]));
+    }
+
+    // response files are expanded upfront, the arguments then outlive the options pointing into them
+    std::vector<std::string> args;
+    if (!clc::expand_response_files(argc, argv, args))
+    {
+        return EXIT_FAILURE;
+    }
+    std::vector<const char *> arg_ptrs;
+    for (const std::string &a : args)
+    {
+        arg_ptrs.push_back(a.c_str());
+    }
 
     clcompile_options opts;
     bool exit;
 
-    int retval = parse_args(argc, argv, exit, opts);
+    int retval = parse_args(static_cast<int>(arg_ptrs.size()), arg_ptrs.data(), exit, opts);
     if (exit)
     {
         return retval;
     }
 
-    clc::compiler c;
-    if (!c.init(opts.platform_id, opts.device_id))
+    clc::binary_cache cache;
+    if (!opts.cache_dir.empty() && !cache.open(opts.cache_dir))
     {
         return EXIT_FAILURE;
     }
 
-    for (const auto &fn : opts.filenames)
+    if (opts.prewarm_trace)
     {
-        char *source = load_file(fn);
-        if (!source)
+        if (!cache.is_open())
         {
+            logerr("prewarming requires a cache directory, see --cache-dir\n");
             return EXIT_FAILURE;
         }
-        on_scope_guard([source]() { delete[] source; });
-        c.build(source);
+
+        std::vector<clc::trace_entry> entries;
+        if (!clc::load_trace(opts.prewarm_trace, opts.platform_id, opts.device_ids[0], entries))
+        {
+            return EXIT_FAILURE;
+        }
+        return clc::prewarm(entries, join_options(opts.clargs), cache, opts.jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    std::vector<clc::manifest_entry> manifest;
+    for (const char *fn : opts.manifests)
+    {
+        if (!clc::load_manifest(fn, manifest))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // devices targeted by manifest entries get a builder too, only building those entries
+    std::map<cl_uint, size_t> builder_index;
+    std::vector<cl_uint> device_ids;
+    for (cl_uint device_id : opts.device_ids)
+    {
+        if (builder_index.insert(std::make_pair(device_id, device_ids.size())).second)
+        {
+            device_ids.push_back(device_id);
+        }
+    }
+    std::vector<size_t> default_builders;
+    for (size_t b = 0; b < device_ids.size(); ++b)
+    {
+        default_builders.push_back(b);
+    }
+    for (const auto &e : manifest)
+    {
+        if (e.device_id >= 0 && builder_index.insert(std::make_pair(e.device_id, device_ids.size())).second)
+        {
+            device_ids.push_back(e.device_id);
+        }
+    }
+
+    std::string options = join_options(opts.clargs);
+    std::vector<clc::build_input> inputs = clc::make_inputs(opts.filenames, options);
+    for (const auto &e : manifest)
+    {
+        clc::build_input input;
+        input.filename = e.source_path;
+        input.name = e.name;
+        input.options = options.empty() || e.options.empty() ? options + e.options : options + ' ' + e.options;
+        if (e.device_id >= 0)
+        {
+            input.builders.push_back(builder_index[e.device_id]);
+        }
+        inputs.push_back(std::move(input));
+    }
+    if (!opts.define_matrix.empty())
+    {
+        clc::apply_variants(opts.define_matrix.variants(), inputs);
+    }
+    if (device_ids.size() > default_builders.size())
+    {
+        for (auto &input : inputs)
+        {
+            if (input.builders.empty())
+            {
+                input.builders = default_builders;
+            }
+        }
+    }
+
+    std::string tuning_fn = opts.tuning_db.empty() && cache.is_open() ? opts.cache_dir + "/tuning" : opts.tuning_db;
+    if ((opts.tune_work_groups || opts.specialize) && tuning_fn.empty())
+    {
+        logerr("work-group size tuning requires a tuning database, see --tuning-db\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opts.bench_specs)
+    {
+        std::vector<clc::kernel_spec> specs;
+        if (!clc::load_kernel_specs(opts.bench_specs, specs))
+        {
+            return EXIT_FAILURE;
+        }
+
+        // benchmarks run in process, one program at a time
+        std::vector<std::unique_ptr<clc::compiler>> compilers;
+        for (cl_uint device_id : device_ids)
+        {
+            compilers.emplace_back(new clc::compiler);
+            if (!compilers.back()->init(opts.platform_id, device_id))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        if (!opts.tune_space.empty())
+        {
+            clc::space_tuning tuning;
+            tuning.runs = opts.bench_runs;
+            tuning.jobs = opts.jobs;
+            tuning.budget = opts.tune_budget;
+            tuning.checkpoint =
+                opts.tune_checkpoint.empty() && cache.is_open() ? opts.cache_dir + "/checkpoint" : opts.tune_checkpoint;
+            tuning.manifest = opts.tune_manifest ? opts.tune_manifest : "";
+            return clc::tune_space(compilers, device_ids, inputs, specs, opts.tune_space, tuning) ? EXIT_SUCCESS
+                                                                                                  : EXIT_FAILURE;
+        }
+        if (opts.tune_work_groups)
+        {
+            clc::tuning_db db;
+            if (!db.load(tuning_fn))
+            {
+                return EXIT_FAILURE;
+            }
+            bool tuned = clc::tune_work_groups(compilers, inputs, specs, opts.bench_runs, db);
+            return db.save(tuning_fn) && tuned ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (opts.tune_options)
+        {
+            clc::option_tuning tuning;
+            tuning.runs = opts.bench_runs;
+            tuning.jobs = opts.jobs;
+            tuning.tolerance = opts.tune_tolerance;
+            return clc::tune_options(compilers, inputs, specs, tuning) ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        return clc::bench_inputs(compilers, inputs, specs, opts.bench_runs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::vector<std::unique_ptr<clc::device_builder>> builders;
+    for (cl_uint device_id : device_ids)
+    {
+        if (opts.isolate)
+        {
+            clc::worker_builder *b =
+                new clc::worker_builder(clc::self_executable(argv[0]), opts.platform_id, device_id, opts.worker_limits);
+            builders.emplace_back(b);
+            if (!b->init())
+            {
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            clc::compiler_builder *b = new clc::compiler_builder;
+            builders.emplace_back(b);
+            if (!b->init(opts.platform_id, device_id))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    if (opts.attribute_build_times)
+    {
+        return clc::attribute_build_times(builders, inputs, opts.jobs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    std::map<std::string, std::map<std::string, std::string>> kernel_maps;
+    if (opts.split_programs)
+    {
+        clc::split_inputs(inputs, opts.split_programs, kernel_maps);
+    }
+    if (opts.coalesce_programs)
+    {
+        clc::coalesce_inputs(inputs, opts.coalesce_programs, kernel_maps);
+    }
+
+    if (opts.specialize)
+    {
+        clc::tuning_db db;
+        if (!db.load(tuning_fn))
+        {
+            return EXIT_FAILURE;
+        }
+        clc::specialize_inputs(builders, db, inputs);
+    }
+
+    clc::output_writer output;
+    if (opts.output && !output.open(opts.format, opts.output))
+    {
+        return EXIT_FAILURE;
+    }
+
+    clc::build_settings settings;
+    settings.jobs = opts.jobs;
+    settings.adaptive_jobs = opts.adaptive_jobs;
+    settings.fail_fast = opts.fail_fast;
+    settings.cache = cache.is_open() ? &cache : nullptr;
+    settings.output = output.is_open() ? &output : nullptr;
+
+    clc::build_history history;
+    std::string history_fn = opts.history.empty() && cache.is_open() ? opts.cache_dir + "/history" : opts.history;
+    if (!history_fn.empty())
+    {
+        history.load(history_fn);
+        settings.history = &history;
+    }
+
+    clc::kernel_report report;
+    if (opts.report)
+    {
+        settings.report = &report;
+    }
+
+    clc::build_stats stats = clc::build_inputs(builders, inputs, settings);
+    if (opts.report)
+    {
+        report.print(opts.report_format);
+    }
+    if (opts.stats)
+    {
+        clc::print_stats(stats);
+    }
+
+    if (settings.history)
+    {
+        history.save(history_fn);
+    }
+
+    // the loader finds the kernels of the split and coalesced programs through their kernel map
+    for (const auto &map : kernel_maps)
+    {
+        if (output.is_open() && !output.add(map.first, clc::kernel_map_identity, clc::kernel_map_data(map.second)))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!output.close())
+    {
+        return EXIT_FAILURE;
+    }
+
+    return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "manifest.h"
+#include "file.h"
+#include "log.h"
+#include "output.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Bounds the nesting of response files, which also catches response files referencing themselves */
+const unsigned max_response_depth = 16;
+
+/** Splits the content of a response file into arguments
+ * @param[in] text Response file content
+ * @param[out] args Receives the arguments
+ */
+void split_response(const char *text, std::vector<std::string> &args)
+{
+    const char *p = text;
+    for (;;)
+    {
+        while (*p && std::isspace(static_cast<unsigned char>(*p)))
+        {
+            ++p;
+        }
+        if (!*p)
+        {
+            return;
+        }
+
+        std::string arg;
+        char quote = 0;
+        for (; *p && (quote || !std::isspace(static_cast<unsigned char>(*p))); ++p)
+        {
+            if (*p == '\\' && p[1])
+            {
+                arg += *++p;
+            }
+            else if (quote && *p == quote)
+            {
+                quote = 0;
+            }
+            else if (!quote && (*p == '"' || *p == '\''))
+            {
+                quote = *p;
+            }
+            else
+            {
+                arg += *p;
+            }
+        }
+        args.push_back(arg);
+    }
+}
+
+/** Appends an argument to the expanded command line, expanding it if it names a response file
+ * @param[in] arg Argument
+ * @param[in] depth Nesting level of the response file the argument comes from
+ * @param[in,out] args Expanded arguments
+ * @return true if succeeded, false otherwise
+ */
+bool expand_arg(const std::string &arg, unsigned depth, std::vector<std::string> &args)
+{
+    if (arg.size() < 2 || arg[0] != '@')
+    {
+        args.push_back(arg);
+        return true;
+    }
+    if (depth >= max_response_depth)
+    {
+        logerr("response files nested too deeply at \"%s\"\n", arg.c_str());
+        return false;
+    }
+
+    char *text = load_file(arg.c_str() + 1);
+    if (!text)
+    {
+        return false;
+    }
+    std::vector<std::string> file_args;
+    split_response(text, file_args);
+    delete[] text;
+
+    for (const std::string &a : file_args)
+    {
+        if (!expand_arg(a, depth + 1, args))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+bool expand_response_files(int argc, const char **argv, std::vector<std::string> &args)
+{
+    args.clear();
+    for (int i = 0; i < argc; ++i)
+    {
+        // the program name is never a response file
+        if (i == 0)
+        {
+            args.push_back(argv[i]);
+        }
+        else if (!expand_arg(argv[i], 0, args))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool load_manifest(const char *fn, std::vector<manifest_entry> &entries)
+{
+    std::ifstream in(fn);
+    if (!in)
+    {
+        logerr("failed opening the manifest file \"%s\"\n", fn);
+        return false;
+    }
+
+    std::string dir(fn);
+    size_t slash = dir.find_last_of('/');
+    dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+    std::string line;
+    for (unsigned lineno = 1; std::getline(in, line); ++lineno)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::vector<std::string> fields = split_fields(line);
+        if (fields.size() > 4 || fields[0].empty())
+        {
+            logerr("%s:%u: malformed manifest entry\n", fn, lineno);
+            return false;
+        }
+
+        manifest_entry entry;
+        entry.source_path = fields[0][0] == '/' ? fields[0] : dir + fields[0];
+        if (fields.size() > 1)
+        {
+            entry.options = fields[1];
+        }
+        entry.name = fields.size() > 2 && !fields[2].empty() ? fields[2] : program_name(fields[0]);
+        if (fields.size() > 3 && !fields[3].empty())
+        {
+            char *end;
+            long device_id = std::strtol(fields[3].c_str(), &end, 10);
+            if (*end || device_id < 0)
+            {
+                logerr("%s:%u: malformed device id \"%s\"\n", fn, lineno, fields[3].c_str());
+                return false;
+            }
+            entry.device_id = static_cast<int>(device_id);
+        }
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
+} // namespace clc
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef manifest_h
+#define manifest_h
+
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Expands the response files of a command line
+ *
+ * Arguments of the form @<file> are replaced by the arguments read from that file, separated by whitespace. Single
+ * and double quotes group whitespace into an argument and a backslash escapes the next character. Response files may
+ * reference other response files.
+ *
+ * @param[in] argc Number of arguments in the @p argv argument array
+ * @param[in] argv Array of zero terminated strings
+ * @param[out] args Receives the expanded arguments
+ * @return true if succeeded, false if a response file could not be read
+ */
+bool expand_response_files(int argc, const char **argv, std::vector<std::string> &args);
+
+/** One program listed in a manifest */
+struct manifest_entry
+{
+    /** Path of the program source */
+    std::string source_path;
+
+    /** Build options */
+    std::string options;
+
+    /** Program name, see @ref program_name */
+    std::string name;
+
+    /** CL Device ID to build the program for, -1 for every targeted device */
+    int device_id = -1;
+};
+
+/** Loads a manifest of programs to build
+ *
+ * The manifest lists one program per line as tab separated fields:
+ *
+ *     <source path>[<TAB><build options>[<TAB><program name>[<TAB><device id>]]]
+ *
+ * Empty lines and lines starting with '#' are ignored. Relative source paths are resolved against the directory of
+ * the manifest file. Empty fields take their default: no build options, the program name derived from the source
+ * path as written, and every targeted device.
+ *
+ * @param[in] fn Manifest filename
+ * @param[out] entries Receives the manifest entries
+ * @return true if succeeded, false otherwise
+ */
+bool load_manifest(const char *fn, std::vector<manifest_entry> &entries);
+
+} // namespace clc
+
+#endif // manifest_h
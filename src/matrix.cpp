@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "matrix.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <set>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Appends build options to others
+ * @param[in,out] options Build options
+ * @param[in] more Build options to append
+ */
+void append_options(std::string &options, const std::string &more)
+{
+    if (!options.empty() && !more.empty())
+    {
+        options += ' ';
+    }
+    options += more;
+}
+
+/** Makes a macro value usable in a program name
+ * @param[in] value Macro value
+ * @return The value, characters other than alphanumerics and "_.+-" replaced by '_'
+ */
+std::string name_safe(const std::string &value)
+{
+    std::string safe(value);
+    for (char &c : safe)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '.' && c != '+' && c != '-')
+        {
+            c = '_';
+        }
+    }
+    return safe;
+}
+
+/** Formats a macro definition as a build option, quoted as by join_options when the value holds whitespace so that
+ * the build does not split it
+ * @param[in] name Macro name
+ * @param[in] value Macro value, empty for a bare definition
+ * @return The build option
+ */
+std::string define_option(const std::string &name, const std::string &value)
+{
+    std::string option = "-D" + name + (value.empty() ? std::string() : "=" + value);
+    return value.find_first_of(" \t") == std::string::npos ? option : '"' + option + '"';
+}
+
+/** Trims the whitespace around a value
+ * @param[in] value Value to trim
+ * @return The trimmed value
+ */
+std::string trim(const std::string &value)
+{
+    size_t first = value.find_first_not_of(" \t\r\n");
+    size_t last = value.find_last_not_of(" \t\r\n");
+    return first == std::string::npos ? std::string() : value.substr(first, last - first + 1);
+}
+
+} // namespace
+
+bool define_matrix::add(const std::string &spec)
+{
+    size_t pos = 0;
+    for (;;)
+    {
+        while (pos < spec.size() && std::isspace(static_cast<unsigned char>(spec[pos])))
+        {
+            ++pos;
+        }
+        if (pos == spec.size())
+        {
+            return true;
+        }
+
+        // a definition spans up to the next whitespace outside of braces
+        size_t end = pos;
+        for (int depth = 0; end < spec.size() && (depth || !std::isspace(static_cast<unsigned char>(spec[end])));
+             ++end)
+        {
+            depth += spec[end] == '{' ? 1 : spec[end] == '}' ? -1 : 0;
+        }
+        std::string def = spec.substr(pos, end - pos);
+        pos = end;
+
+        size_t eq = def.find('=');
+        macro m;
+        m.name = def.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        if (def.compare(0, 2, "-D") != 0 || m.name.empty())
+        {
+            logerr("invalid macro definition \"%s\", expected -D<NAME>[=<value>] or -D<NAME>={<value>,...}\n",
+                   def.c_str());
+            return false;
+        }
+
+        std::string value = eq == std::string::npos ? std::string() : def.substr(eq + 1);
+        if (value.size() >= 2 && value.front() == '{' && value.back() == '}')
+        {
+            m.list = true;
+            size_t start = 1;
+            for (;;)
+            {
+                size_t comma = value.find(',', start);
+                size_t stop = comma == std::string::npos ? value.size() - 1 : comma;
+                std::string v = trim(value.substr(start, stop - start));
+                if (v.empty())
+                {
+                    logerr("empty value in the macro definition \"%s\"\n", def.c_str());
+                    return false;
+                }
+                if (v.find('"') != std::string::npos && v.find_first_of(" \t") != std::string::npos)
+                {
+                    logerr("value \"%s\" of the macro definition \"%s\" cannot be quoted\n", v.c_str(), def.c_str());
+                    return false;
+                }
+                m.values.push_back(v);
+                if (comma == std::string::npos)
+                {
+                    break;
+                }
+                start = comma + 1;
+            }
+        }
+        else if (eq == std::string::npos)
+        {
+            m.values.push_back(std::string());
+        }
+        else
+        {
+            m.values.push_back(value);
+        }
+
+        // values told apart by characters name_safe replaces get their index appended, so that names stay unique
+        std::map<std::string, size_t> uses;
+        for (const std::string &v : m.values)
+        {
+            ++uses[name_safe(v)];
+        }
+        std::set<std::string> suffixes;
+        for (size_t i = 0; i < m.values.size(); ++i)
+        {
+            std::string safe = name_safe(m.values[i]);
+            m.suffixes.push_back("." + m.name + "=" + safe + (uses[safe] > 1 ? "-" + std::to_string(i) : ""));
+            if (m.list && !suffixes.insert(m.suffixes.back()).second)
+            {
+                logerr("values of the macro definition \"%s\" cannot be told apart in program names\n", def.c_str());
+                return false;
+            }
+        }
+        m_macros.push_back(m);
+    }
+}
+
+std::vector<define_variant> define_matrix::variants() const
+{
+    // every choice of values, the last macro varying the fastest
+    std::vector<define_variant> variants;
+    std::vector<size_t> sizes = shape();
+    if (std::find(sizes.begin(), sizes.end(), size_t(0)) != sizes.end())
+    {
+        return variants;
+    }
+    std::vector<size_t> choice(sizes.size());
+    for (;;)
+    {
+        variants.push_back(variant(choice));
+        size_t i = choice.size();
+        for (; i > 0; --i)
+        {
+            if (++choice[i - 1] < sizes[i - 1])
+            {
+                break;
+            }
+            choice[i - 1] = 0;
+        }
+        if (i == 0)
+        {
+            return variants;
+        }
+    }
+}
+
+std::vector<size_t> define_matrix::shape() const
+{
+    std::vector<size_t> shape;
+    for (const macro &m : m_macros)
+    {
+        shape.push_back(m.values.size());
+    }
+    return shape;
+}
+
+define_variant define_matrix::variant(const std::vector<size_t> &choice) const
+{
+    define_variant v;
+    for (size_t i = 0; i < m_macros.size(); ++i)
+    {
+        const macro &m = m_macros[i];
+        append_options(v.options, define_option(m.name, m.values[choice[i]]));
+        if (m.list)
+        {
+            v.suffix += m.suffixes[choice[i]];
+        }
+    }
+    return v;
+}
+
+void apply_variants(const std::vector<define_variant> &variants, std::vector<build_input> &inputs)
+{
+    std::vector<build_input> expanded;
+    expanded.reserve(inputs.size() * variants.size());
+    for (const build_input &input : inputs)
+    {
+        for (const define_variant &v : variants)
+        {
+            build_input e = input;
+            append_options(e.options, v.options);
+            e.name += v.suffix;
+            expanded.push_back(e);
+        }
+    }
+    inputs.swap(expanded);
+}
+
+} // namespace clc
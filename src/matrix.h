@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef matrix_h
+#define matrix_h
+
+#include "driver.h"
+
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Build options and name suffix of one combination of a @ref define_matrix */
+struct define_variant
+{
+    /** Macro definitions to append to the build options */
+    std::string options;
+
+    /** Suffix appended to the program name, eg: ".TYPE=float.TILE=8" */
+    std::string suffix;
+};
+
+/** Macro definitions expanding into the cartesian product of their values
+ *
+ * Definitions are given as -D<NAME>={<value>,...} for a macro taking each of the listed values in turn, or as the
+ * usual -D<NAME>[=<value>] for a macro defined the same in every combination.
+ */
+class define_matrix
+{
+  public:
+    /** Adds macro definitions to the matrix
+     * @param[in] spec Whitespace separated definitions, eg: "-DTYPE={float,half} -DTILE={8,16,32}", the whitespace
+     * around the values of a list being ignored
+     * @return true if succeeded, false if the definitions are malformed
+     */
+    bool add(const std::string &spec);
+
+    /** @return true if no definition was added */
+    bool empty() const
+    {
+        return m_macros.empty();
+    }
+
+    /** Enumerates the combinations of the matrix
+     *
+     * Combinations are ordered with the values of the first macro varying the slowest, in the order they were listed.
+     * The name suffix lists the values of the macros taking several ones, characters other than alphanumerics and
+     * "_.+-" replaced by '_', so that the variant names are deterministic and usable as filenames. Values of a macro
+     * only told apart by the replaced characters get their index appended, e.g. ".OP=a_b-0" and ".OP=a_b-1". Values
+     * holding whitespace are passed quoted to the build.
+     *
+     * @return The combinations
+     */
+    std::vector<define_variant> variants() const;
+
+    /** @return The number of values of each macro, in order */
+    std::vector<size_t> shape() const;
+
+    /** Builds one combination of the matrix
+     * @param[in] choice Index of the value of each macro, see @ref shape
+     * @return The combination, named as by @ref variants
+     */
+    define_variant variant(const std::vector<size_t> &choice) const;
+
+  private:
+    /** macro definitions, in order, each with its values, the program name suffix of each value and whether it is a
+     * list */
+    struct macro
+    {
+        std::string name;
+        std::vector<std::string> values;
+        std::vector<std::string> suffixes;
+        bool list = false;
+    };
+    std::vector<macro> m_macros;
+};
+
+/** Replaces every input by one input per variant
+ *
+ * @param[in] variants Variants, see @ref define_matrix::variants
+ * @param[in,out] inputs Inputs to expand, the variants of an input follow each other
+ */
+void apply_variants(const std::vector<define_variant> &variants, std::vector<build_input> &inputs);
+
+} // namespace clc
+
+#endif // matrix_h
@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "output.h"
+#include "file.h"
+#include "hash.h"
+#include "log.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace clc
+{
+
+bool parse_output_format(const char *name, output_format &format)
+{
+    if (!std::strcmp(name, "binary"))
+    {
+        format = output_format::binary;
+    }
+    else if (!std::strcmp(name, "bundle"))
+    {
+        format = output_format::bundle;
+    }
+    else if (!std::strcmp(name, "cxx"))
+    {
+        format = output_format::cxx;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string program_name(const std::string &fn)
+{
+    std::string name = fn;
+    while (name.compare(0, 2, "./") == 0)
+    {
+        name.erase(0, 2);
+    }
+    if (name.size() > 3 && !name.compare(name.size() - 3, 3, ".cl"))
+    {
+        name.resize(name.size() - 3);
+    }
+    return name;
+}
+
+bool output_writer::open(output_format format, const std::string &path)
+{
+    // file outputs only need their parent directory
+    size_t slash = path.find_last_of('/');
+    std::string dir = format == output_format::binary ? path
+                      : slash == std::string::npos    ? std::string(".")
+                                                      : path.substr(0, slash);
+    if (path.empty() || !make_dirs(dir))
+    {
+        logerr("could not create the output directory \"%s\"\n", dir.c_str());
+        return false;
+    }
+    m_format = format;
+    m_path = path;
+    return true;
+}
+
+bool output_writer::add(const std::string &name, const std::string &identity, std::vector<unsigned char> binary)
+{
+    if (m_format == output_format::bundle)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bundle.add(name, identity, std::move(binary));
+        return true;
+    }
+    if (m_format == output_format::cxx)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cxx.add(name, identity, std::move(binary));
+        return true;
+    }
+
+    std::string fn = binary_filename(name, identity);
+    size_t slash = fn.find_last_of('/');
+    if (!make_dirs(fn.substr(0, slash)))
+    {
+        logerr("could not create the output directory for \"%s\"\n", fn.c_str());
+        return false;
+    }
+
+    FILE *f = std::fopen(fn.c_str(), "wb");
+    if (!f)
+    {
+        logerr("failed creating the output file \"%s\"\n", fn.c_str());
+        return false;
+    }
+    bool written = std::fwrite(binary.data(), 1, binary.size(), f) == binary.size();
+    if (std::fclose(f) != 0 || !written)
+    {
+        logerr("failed writing the output file \"%s\"\n", fn.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool output_writer::copy(const std::string &from, const std::string &name, const std::string &identity)
+{
+    std::vector<unsigned char> binary;
+    bool found = false;
+    if (m_format == output_format::bundle || m_format == output_format::cxx)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        found = m_format == output_format::bundle ? m_bundle.find(from, identity, binary)
+                                                  : m_cxx.find(from, identity, binary);
+    }
+    else if (FILE *f = std::fopen(binary_filename(from, identity).c_str(), "rb"))
+    {
+        unsigned char buffer[65536];
+        size_t n;
+        while ((n = std::fread(buffer, 1, sizeof(buffer), f)) > 0)
+        {
+            binary.insert(binary.end(), buffer, buffer + n);
+        }
+        found = !std::ferror(f);
+        std::fclose(f);
+    }
+    if (!found)
+    {
+        logerr("could not find the binary of \"%s\" to copy it to \"%s\"\n", from.c_str(), name.c_str());
+        return false;
+    }
+    return add(name, identity, std::move(binary));
+}
+
+std::string output_writer::binary_filename(const std::string &name, const std::string &identity) const
+{
+    return m_path + "/" + name + "." + hash_str(fnv1a64(identity)) + ".bin";
+}
+
+bool output_writer::close()
+{
+    if (!is_open())
+    {
+        return true;
+    }
+    if (m_format == output_format::bundle)
+    {
+        return m_bundle.write(m_path.c_str());
+    }
+    if (m_format == output_format::cxx)
+    {
+        return m_cxx.write(m_path);
+    }
+    return true;
+}
+
+} // namespace clc
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef output_h
+#define output_h
+
+#include "bundle.h"
+#include "embed.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Output formats */
+enum class output_format
+{
+    /** one binary file per program and device */
+    binary,
+
+    /** a single bundle file for all programs and devices, see @ref bundle_header */
+    bundle,
+
+    /** a C++ header/source pair embedding all programs and devices, see @ref cxx_writer */
+    cxx,
+};
+
+/** Parses an output format name
+ * @param[in] name Format name
+ * @param[out] format Receives the parsed format
+ * @return true if succeeded, false if the name is unknown
+ */
+bool parse_output_format(const char *name, output_format &format);
+
+/** Derives a program name from its source filename, dropping any "./" prefix and ".cl" extension
+ * @param[in] fn Source filename
+ * @return The program name
+ */
+std::string program_name(const std::string &fn);
+
+/** Writes built program binaries in the chosen output format, safe to use from concurrent builds */
+class output_writer
+{
+  public:
+    /** Opens the output
+     *
+     * @param[in] format Output format
+     * @param[in] path Output directory for @ref output_format::binary, output file for @ref output_format::bundle,
+     * output file without extension for @ref output_format::cxx
+     * @return true if succeeded, false otherwise
+     */
+    bool open(output_format format, const std::string &path);
+
+    /** @return true if the output was successfully opened */
+    bool is_open() const
+    {
+        return !m_path.empty();
+    }
+
+    /** Adds a program binary
+     *
+     * @param[in] name Program name
+     * @param[in] identity Device identity the binary was built for
+     * @param[in] binary Program binary
+     * @return true if succeeded, false otherwise
+     */
+    bool add(const std::string &name, const std::string &identity, std::vector<unsigned char> binary);
+
+    /** Adds a copy of a binary previously added under another program name
+     *
+     * @param[in] from Program name the binary was added under
+     * @param[in] name Program name to add the copy under
+     * @param[in] identity Device identity the binary was built for
+     * @return true if succeeded, false otherwise
+     */
+    bool copy(const std::string &from, const std::string &name, const std::string &identity);
+
+    /** Flushes the binaries added so far to the output
+     * @return true if succeeded, false otherwise
+     */
+    bool close();
+
+  private:
+    /** @return The filename of a binary for @ref output_format::binary */
+    std::string binary_filename(const std::string &name, const std::string &identity) const;
+
+    /** output format */
+    output_format m_format = output_format::binary;
+
+    /** output path, empty when not open */
+    std::string m_path;
+
+    /** serializes concurrent additions */
+    std::mutex m_mutex;
+
+    /** accumulated binaries for @ref output_format::bundle */
+    bundle_writer m_bundle;
+
+    /** accumulated binaries for @ref output_format::cxx */
+    cxx_writer m_cxx;
+};
+
+} // namespace clc
+
+#endif // output_h
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "parallel.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace clc
+{
+
+void run_workers(unsigned jobs, const std::function<bool()> &step)
+{
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < std::max(1u, jobs); ++t)
+    {
+        threads.emplace_back([&step]() {
+            while (step())
+            {
+            }
+        });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+adaptive_result adaptive_run(unsigned max_jobs, const std::function<bool()> &step)
+{
+    typedef std::chrono::steady_clock clock;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned limit = 1;
+    bool done = false;
+    size_t completed = 0;
+
+    max_jobs = std::max(1u, max_jobs);
+
+    // threads above the current limit sleep until the limit grows or the work runs out
+    auto worker = [&](unsigned id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            cond.wait(lock, [&]() { return id < limit || done; });
+            if (done)
+            {
+                return;
+            }
+
+            lock.unlock();
+            bool more = step();
+            lock.lock();
+
+            if (!more)
+            {
+                done = true;
+                cond.notify_all();
+                return;
+            }
+            ++completed;
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < max_jobs; ++t)
+    {
+        threads.emplace_back(worker, t);
+    }
+
+    adaptive_result result;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            // measure over a few steps per thread, the first ones of a level start with the level
+            size_t start_count = completed;
+            size_t window = 2 * static_cast<size_t>(limit);
+            clock::time_point start = clock::now();
+            cond.wait(lock, [&]() { return completed >= start_count + window || done; });
+            if (completed < start_count + window)
+            {
+                break;
+            }
+
+            std::chrono::duration<double> elapsed = clock::now() - start;
+            double throughput = (completed - start_count) / std::max(elapsed.count(), 1e-9);
+            if (throughput > result.throughput * 1.1)
+            {
+                result.jobs = limit;
+                result.throughput = throughput;
+                if (limit < max_jobs)
+                {
+                    limit = std::min(2 * limit, max_jobs);
+                    cond.notify_all();
+                    continue;
+                }
+            }
+
+            limit = result.jobs;
+            break;
+        }
+    }
+
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    return result;
+}
+
+} // namespace clc
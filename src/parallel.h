@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef parallel_h
+#define parallel_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace clc
+{
+
+/** @return The default number of concurrent jobs, one per hardware thread */
+inline unsigned default_jobs()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/** Calls a functor for every index of a range, spreading the calls over several threads
+ *
+ * Indices are handed out in increasing order, each one to the first idle thread.
+ *
+ * @param[in] count Number of indices, the functor is called for [0, count)
+ * @param[in] jobs Maximum number of threads running concurrently, the calling thread included
+ * @param[in] fn Functor called with each index, must be safe to call concurrently
+ */
+template <typename F> void parallel_for(size_t count, unsigned jobs, const F &fn)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            fn(i);
+        }
+    };
+
+    size_t nthreads = std::min(static_cast<size_t>(std::max(1u, jobs)), count);
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < nthreads; ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+/** Runs a work step on several threads until the work runs out
+ *
+ * @param[in] jobs Number of threads, the calling thread waits for them
+ * @param[in] step Functor processing one unit of work, returning false once there is no work left. Must be safe to
+ * call concurrently
+ */
+void run_workers(unsigned jobs, const std::function<bool()> &step);
+
+/** Outcome of an @ref adaptive_run */
+struct adaptive_result
+{
+    /** Concurrency level the ramp up settled on */
+    unsigned jobs = 1;
+
+    /** Steps per second measured at that level, 0 if never measured */
+    double throughput = 0;
+};
+
+/** Runs a work step on a number of threads adapted to the achieved throughput, until the work runs out
+ *
+ * Some OpenCL drivers serialize builds behind a global lock, additional threads then only add contention. The
+ * concurrency starts at one thread and doubles as long as each step improves the number of steps completed per
+ * second by at least 10%, it then settles on the best level measured.
+ *
+ * @param[in] max_jobs Maximum number of threads running concurrently
+ * @param[in] step Functor processing one unit of work, returning false once there is no work left. Must be safe to
+ * call concurrently
+ * @return The concurrency level settled on
+ */
+adaptive_result adaptive_run(unsigned max_jobs, const std::function<bool()> &step);
+
+} // namespace clc
+
+#endif // parallel_h
@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "prewarm.h"
+#include "cache.h"
+#include "clc.h"
+#include "file.h"
+#include "log.h"
+#include "parallel.h"
+#include "scope_guard.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace clc
+{
+
+bool load_trace(const char *fn, cl_uint platform_id, cl_uint device_id, std::vector<trace_entry> &entries)
+{
+    std::ifstream in(fn);
+    if (!in)
+    {
+        logerr("failed opening the trace file \"%s\"\n", fn);
+        return false;
+    }
+
+    std::string dir(fn);
+    size_t slash = dir.find_last_of('/');
+    dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+    std::string line;
+    for (unsigned lineno = 1; std::getline(in, line); ++lineno)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::vector<std::string> fields = split_fields(line);
+        if (fields.size() > 3 || fields[0].empty())
+        {
+            logerr("%s:%u: malformed trace entry\n", fn, lineno);
+            return false;
+        }
+
+        trace_entry entry;
+        entry.source_path = fields[0][0] == '/' ? fields[0] : dir + fields[0];
+        entry.platform_id = platform_id;
+        entry.device_id = device_id;
+        if (fields.size() > 1)
+        {
+            entry.options = fields[1];
+        }
+        if (fields.size() > 2)
+        {
+            char *end;
+            entry.platform_id = std::strtoul(fields[2].c_str(), &end, 10);
+            if (*end != ':')
+            {
+                logerr("%s:%u: malformed device \"%s\", expected <platform id>:<device id>\n", fn, lineno,
+                       fields[2].c_str());
+                return false;
+            }
+            entry.device_id = std::strtoul(end + 1, &end, 10);
+        }
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
+bool prewarm(const std::vector<trace_entry> &entries, const std::string &options, const binary_cache &cache,
+             unsigned jobs)
+{
+    // contexts are created upfront, builds then only read the map concurrently
+    typedef std::pair<cl_uint, cl_uint> device_index;
+    std::map<device_index, std::unique_ptr<compiler>> compilers;
+    for (const auto &e : entries)
+    {
+        std::unique_ptr<compiler> &c = compilers[device_index(e.platform_id, e.device_id)];
+        if (!c)
+        {
+            c.reset(new compiler);
+            if (!c->init(e.platform_id, e.device_id))
+            {
+                logerr("programs targeting platform=%u device=%u will not be prewarmed\n", e.platform_id,
+                       e.device_id);
+            }
+        }
+    }
+
+    std::atomic<size_t> cached(0);
+    std::atomic<size_t> failed(0);
+    parallel_for(entries.size(), jobs, [&](size_t i) {
+        const trace_entry &e = entries[i];
+        const compiler &c = *compilers.find(device_index(e.platform_id, e.device_id))->second;
+        if (c.identity().empty())
+        {
+            ++failed;
+            return;
+        }
+
+        char *source = load_file(e.source_path.c_str());
+        if (!source)
+        {
+            ++failed;
+            return;
+        }
+        on_scope_guard([source]() { delete[] source; });
+
+        const std::string build_options =
+            options.empty() || e.options.empty() ? options + e.options : options + ' ' + e.options;
+        uint64_t key = binary_cache::key(c.identity(), build_options, source);
+        if (cache.contains(key))
+        {
+            ++cached;
+            return;
+        }
+
+        std::vector<unsigned char> binary;
+        if (!c.build(source, build_options.c_str(), &binary) || !cache.store(key, binary))
+        {
+            logerr("failed prewarming \"%s\"\n", e.source_path.c_str());
+            ++failed;
+        }
+    });
+
+    loginfo("prewarmed %zu programs (%zu already cached, %zu failed)\n", entries.size() - cached - failed,
+            cached.load(), failed.load());
+
+    return failed == 0;
+}
+
+} // namespace clc
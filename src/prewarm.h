@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef prewarm_h
+#define prewarm_h
+
+#include <CL/cl.h>
+
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+class binary_cache;
+
+/** One program build recorded from an application */
+struct trace_entry
+{
+    /** Path of the program source */
+    std::string source_path;
+
+    /** Build options */
+    std::string options;
+
+    /** CL Platform ID the program was built for */
+    cl_uint platform_id = 0;
+
+    /** CL Device ID the program was built for */
+    cl_uint device_id = 0;
+};
+
+/** Loads a recorded application trace
+ *
+ * The trace lists one program per line as tab separated fields:
+ *
+ *     <source path>[<TAB><build options>[<TAB><platform id>:<device id>]]
+ *
+ * Empty lines and lines starting with '#' are ignored. Relative source paths are resolved against the directory of
+ * the trace file. Entries with no device use the provided default platform and device.
+ *
+ * @param[in] fn Trace filename
+ * @param[in] platform_id Default platform index
+ * @param[in] device_id Default device index
+ * @param[out] entries Receives the trace entries
+ * @return true if succeeded, false otherwise
+ */
+bool load_trace(const char *fn, cl_uint platform_id, cl_uint device_id, std::vector<trace_entry> &entries);
+
+/** Compiles every traced program missing from the binary cache
+ *
+ * @param[in] entries Trace entries
+ * @param[in] options Build options common to all entries, prepended to their own
+ * @param[in] cache Binary cache to fill
+ * @param[in] jobs Maximum number of concurrent builds
+ * @return true if every program is in the cache on return, false otherwise
+ */
+bool prewarm(const std::vector<trace_entry> &entries, const std::string &options, const binary_cache &cache,
+             unsigned jobs);
+
+} // namespace clc
+
+#endif // prewarm_h
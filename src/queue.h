@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef queue_h
+#define queue_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace clc
+{
+
+/** Bounded multi producer multi consumer queue connecting pipeline stages
+ *
+ * Producers block while the queue is full, which bounds the memory held between stages and lets a slow stage throttle
+ * the ones feeding it. Consumers block while the queue is empty, until the producers close it.
+ */
+template <typename T> class bounded_queue
+{
+  public:
+    /** ctor
+     * @param[in] capacity Maximum number of queued elements
+     */
+    explicit bounded_queue(size_t capacity) : m_capacity(capacity ? capacity : 1)
+    {
+    }
+
+    /** Queues an element, blocking while the queue is full
+     * @param[in] v Element to queue
+     */
+    void push(T v)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [this]() { return m_queue.size() < m_capacity; });
+        m_queue.push_back(std::move(v));
+        m_not_empty.notify_one();
+    }
+
+    /** Dequeues an element, blocking while the queue is empty and still open
+     * @param[out] v Receives the element
+     * @return true if an element was dequeued, false if the queue is closed and drained
+     */
+    bool pop(T &v)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_empty.wait(lock, [this]() { return !m_queue.empty() || m_closed; });
+        if (m_queue.empty())
+        {
+            return false;
+        }
+        v = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_not_full.notify_one();
+        return true;
+    }
+
+    /** Closes the queue, consumers drain the queued elements then stop */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_not_empty.notify_all();
+    }
+
+  private:
+    /** maximum number of queued elements */
+    size_t m_capacity;
+
+    /** queued elements */
+    std::deque<T> m_queue;
+
+    /** set once the producers are done */
+    bool m_closed = false;
+
+    /** protects the queue state */
+    std::mutex m_mutex;
+
+    /** signaled when an element gets queued or the queue closed */
+    std::condition_variable m_not_empty;
+
+    /** signaled when an element gets dequeued */
+    std::condition_variable m_not_full;
+};
+
+} // namespace clc
+
+#endif // queue_h
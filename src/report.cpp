@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "report.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Quotes a string as a JSON string literal
+ * @param[in] s String to quote
+ * @return The quoted string
+ */
+std::string json_str(const std::string &s)
+{
+    std::string quoted("\"");
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+            quoted += escaped;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+} // namespace
+
+bool parse_report_format(const char *name, report_format &format)
+{
+    if (!std::strcmp(name, "table"))
+    {
+        format = report_format::table;
+    }
+    else if (!std::strcmp(name, "json"))
+    {
+        format = report_format::json;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void kernel_report::add(const std::string &program, const std::string &identity,
+                        const std::vector<kernel_resources> &kernels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const kernel_resources &k : kernels)
+    {
+        entry e;
+        e.program = program;
+        e.identity = identity;
+        e.kernel = k;
+        m_entries.push_back(std::move(e));
+    }
+}
+
+void kernel_report::print(report_format format) const
+{
+    std::vector<entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        entries = m_entries;
+    }
+    // builds complete in any order, the kernels of a program keep the order the driver reports them in
+    std::stable_sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return a.program != b.program ? a.program < b.program : a.identity < b.identity;
+    });
+
+    if (format == report_format::json)
+    {
+        std::printf("[");
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            const entry &e = entries[i];
+            std::printf("%s\n  {\"program\": %s, \"device\": %s, \"kernel\": %s, \"local_mem_bytes\": %llu, "
+                        "\"private_mem_bytes\": %llu, \"max_work_group_size\": %zu, \"preferred_multiple\": %zu, "
+                        "\"compute_units\": %u, \"work_groups_per_compute_unit\": %zu, \"occupancy\": %.3f, "
+                        "\"limiter\": %s}",
+                        i ? "," : "", json_str(e.program).c_str(), json_str(e.identity).c_str(),
+                        json_str(e.kernel.name).c_str(), static_cast<unsigned long long>(e.kernel.local_mem),
+                        static_cast<unsigned long long>(e.kernel.private_mem), e.kernel.work_group_size,
+                        e.kernel.preferred_multiple, e.kernel.compute_units, e.kernel.work_groups_per_cu,
+                        e.kernel.occupancy, json_str(e.kernel.limiter).c_str());
+        }
+        std::printf("%s]\n", entries.empty() ? "" : "\n");
+        return;
+    }
+
+    int program_width = static_cast<int>(std::strlen("program"));
+    int kernel_width = static_cast<int>(std::strlen("kernel"));
+    for (const entry &e : entries)
+    {
+        program_width = std::max(program_width, static_cast<int>(e.program.size()));
+        kernel_width = std::max(kernel_width, static_cast<int>(e.kernel.name.size()));
+    }
+    std::printf("%-*s  %-*s  %10s  %11s  %8s  %8s  %6s  %9s  %-11s  %s\n", program_width, "program", kernel_width,
+                "kernel", "local_mem", "private_mem", "max_wg", "multiple", "wg/cu", "occupancy", "limiter", "device");
+    for (const entry &e : entries)
+    {
+        std::printf("%-*s  %-*s  %10llu  %11llu  %8zu  %8zu  %6zu  %8.0f%%  %-11s  %s\n", program_width,
+                    e.program.c_str(), kernel_width, e.kernel.name.c_str(),
+                    static_cast<unsigned long long>(e.kernel.local_mem),
+                    static_cast<unsigned long long>(e.kernel.private_mem), e.kernel.work_group_size,
+                    e.kernel.preferred_multiple, e.kernel.work_groups_per_cu, e.kernel.occupancy * 100,
+                    e.kernel.limiter.c_str(), e.identity.c_str());
+    }
+}
+
+} // namespace clc
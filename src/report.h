@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef report_h
+#define report_h
+
+#include "clc.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Kernel report formats */
+enum class report_format
+{
+    /** aligned columns, one kernel per line */
+    table,
+
+    /** a JSON array of one object per kernel */
+    json,
+};
+
+/** Parses a report format name
+ * @param[in] name Format name
+ * @param[out] format Receives the parsed format
+ * @return true if succeeded, false if the name is unknown
+ */
+bool parse_report_format(const char *name, report_format &format);
+
+/** Resources used by the kernels of the built programs, safe to fill from concurrent builds */
+class kernel_report
+{
+  public:
+    /** Adds the kernels of a program built for a device
+     * @param[in] program Program name
+     * @param[in] identity Device identity, see @ref device_identity
+     * @param[in] kernels Resources of each kernel, see @ref get_kernel_resources
+     */
+    void add(const std::string &program, const std::string &identity, const std::vector<kernel_resources> &kernels);
+
+    /** Prints the kernels to stdout, sorted by program and device
+     * @param[in] format Report format
+     */
+    void print(report_format format) const;
+
+  private:
+    /** kernel of a program built for a device */
+    struct entry
+    {
+        std::string program;
+        std::string identity;
+        kernel_resources kernel;
+    };
+
+    /** serializes the accesses to @ref m_entries */
+    mutable std::mutex m_mutex;
+
+    /** kernels added so far */
+    std::vector<entry> m_entries;
+};
+
+} // namespace clc
+
+#endif // report_h
@@ -0,0 +1,845 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "source.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Kernel definition found in a source text */
+struct kernel_definition
+{
+    /** kernel name */
+    std::string name;
+
+    /** offset of the kernel qualifier */
+    size_t begin = 0;
+
+    /** offset just past the body, or the semicolon of a declaration */
+    size_t end = 0;
+
+    /** offset just past the kernel qualifier, where attributes may be inserted */
+    size_t qualifier_end = 0;
+
+    /** whether the kernel already carries a reqd_work_group_size attribute */
+    bool has_reqd_size = false;
+
+    /** whether this is the definition of the kernel rather than a declaration */
+    bool has_body = false;
+};
+
+/** @return Whether a character may start an identifier */
+bool is_ident_start(char c)
+{
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/** @return Whether a character may continue an identifier */
+bool is_ident(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+/** Skips whitespace, comments, line continuations and preprocessor directives
+ * @param[in] src Source text
+ * @param[in] i Offset to start from
+ * @return The offset of the next token, the source size at the end
+ */
+size_t skip_blanks(const std::string &src, size_t i)
+{
+    const size_t n = src.size();
+    // directives only start lines, the beginning of the text counts as one
+    bool line_start = i == 0 || src[i - 1] == '\n';
+    while (i < n)
+    {
+        char c = src[i];
+        if (c == '\n')
+        {
+            line_start = true;
+            ++i;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+        {
+            ++i;
+        }
+        else if (c == '\\' && i + 1 < n && src[i + 1] == '\n')
+        {
+            i += 2;
+        }
+        else if (c == '/' && i + 1 < n && src[i + 1] == '/')
+        {
+            size_t end = src.find('\n', i);
+            i = end == std::string::npos ? n : end;
+        }
+        else if (c == '/' && i + 1 < n && src[i + 1] == '*')
+        {
+            size_t end = src.find("*/", i + 2);
+            i = end == std::string::npos ? n : end + 2;
+        }
+        else if (c == '#' && line_start)
+        {
+            // up to the end of the line, continuations included
+            while (i < n && src[i] != '\n')
+            {
+                i += src[i] == '\\' && i + 1 < n ? 2 : 1;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    return i;
+}
+
+/** Skips a token
+ * @param[in] src Source text
+ * @param[in] i Offset of the token
+ * @return The offset just past the token
+ */
+size_t skip_token(const std::string &src, size_t i)
+{
+    const size_t n = src.size();
+    char c = src[i];
+    if (is_ident(c))
+    {
+        while (i < n && is_ident(src[i]))
+        {
+            ++i;
+        }
+        return i;
+    }
+    if (c == '"' || c == '\'')
+    {
+        for (++i; i < n && src[i] != c && src[i] != '\n'; ++i)
+        {
+            if (src[i] == '\\')
+            {
+                ++i;
+            }
+        }
+        return std::min(i + 1, n);
+    }
+    return i + 1;
+}
+
+/** Skips a parenthesized or braced group of tokens
+ * @param[in] src Source text
+ * @param[in] i Offset of the opening token
+ * @return The offset just past the matching closing token, the source size if unbalanced
+ */
+size_t skip_group(const std::string &src, size_t i)
+{
+    const size_t n = src.size();
+    int depth = 0;
+    do
+    {
+        i = skip_blanks(src, i);
+        if (i >= n)
+        {
+            return n;
+        }
+        char c = src[i];
+        depth += c == '(' || c == '{' ? 1 : c == ')' || c == '}' ? -1 : 0;
+        i = skip_token(src, i);
+    } while (depth > 0);
+    return i;
+}
+
+/** Finds the kernels defined by a source text
+ * @param[in] src Source text
+ * @return The kernel definitions, in order
+ */
+std::vector<kernel_definition> find_kernels(const std::string &src)
+{
+    std::vector<kernel_definition> kernels;
+    const size_t n = src.size();
+    for (size_t i = skip_blanks(src, 0); i < n; i = skip_blanks(src, i))
+    {
+        size_t end = skip_token(src, i);
+        std::string token = src.substr(i, end - i);
+        if (token == "{")
+        {
+            // function bodies and initializers hold no kernel
+            i = skip_group(src, i);
+            continue;
+        }
+        kernel_definition k;
+        k.begin = i;
+        i = end;
+        if (token != "kernel" && token != "__kernel")
+        {
+            continue;
+        }
+
+        // the kernel name is the last identifier before the parameter list
+        k.qualifier_end = i;
+        std::string last;
+        while (i < n)
+        {
+            i = skip_blanks(src, i);
+            if (i >= n || src[i] == ';' || src[i] == '{' || src[i] == ')')
+            {
+                break;
+            }
+            end = skip_token(src, i);
+            token = src.substr(i, end - i);
+            i = end;
+            if (token == "__attribute__")
+            {
+                // balanced parentheses of the attribute
+                int depth = 0;
+                do
+                {
+                    i = skip_blanks(src, i);
+                    if (i >= n)
+                    {
+                        break;
+                    }
+                    end = skip_token(src, i);
+                    token = src.substr(i, end - i);
+                    i = end;
+                    depth += token == "(" ? 1 : token == ")" ? -1 : 0;
+                    k.has_reqd_size = k.has_reqd_size || token == "reqd_work_group_size";
+                } while (depth > 0);
+            }
+            else if (token == "(")
+            {
+                k.name = last;
+                i = skip_group(src, end - 1);
+                break;
+            }
+            else if (is_ident_start(token[0]))
+            {
+                last = token;
+            }
+        }
+        if (k.name.empty())
+        {
+            continue;
+        }
+
+        // up to the end of the body, or of the declaration
+        while (i < n)
+        {
+            i = skip_blanks(src, i);
+            if (i >= n)
+            {
+                break;
+            }
+            if (src[i] == '{')
+            {
+                k.has_body = true;
+                i = skip_group(src, i);
+                break;
+            }
+            bool semicolon = src[i] == ';';
+            i = skip_token(src, i);
+            if (semicolon)
+            {
+                break;
+            }
+        }
+        k.end = i;
+        kernels.push_back(k);
+    }
+    return kernels;
+}
+
+/** Top level declaration or function definition of a source text */
+struct declaration
+{
+    /** offset of the first token */
+    size_t begin = 0;
+
+    /** offset just past the closing brace or semicolon */
+    size_t end = 0;
+
+    /** name of the defined function, empty if not a function definition */
+    std::string function;
+
+    /** whether the defined function is a kernel */
+    bool kernel = false;
+};
+
+/** Splits a source text into its top level declarations, the preprocessor directives being left out of them
+ * @param[in] src Source text
+ * @return The declarations, in order
+ */
+std::vector<declaration> find_declarations(const std::string &src)
+{
+    std::vector<declaration> declarations;
+    const size_t n = src.size();
+    size_t i = skip_blanks(src, 0);
+    while (i < n)
+    {
+        declaration d;
+        d.begin = i;
+        // a function definition is a parameter list followed by a body, its name the identifier before the list
+        std::string last;
+        std::string name;
+        bool parameters = false;
+        while (i < n)
+        {
+            size_t end = skip_token(src, i);
+            std::string token = src.substr(i, end - i);
+            if (token == ";")
+            {
+                i = end;
+                break;
+            }
+            if (token == "{")
+            {
+                i = skip_group(src, i);
+                if (parameters && !name.empty())
+                {
+                    d.function = name;
+                    break;
+                }
+            }
+            else if (token == "(")
+            {
+                if (last != "__attribute__" && name.empty() && !last.empty())
+                {
+                    name = last;
+                    parameters = true;
+                }
+                i = skip_group(src, i);
+            }
+            else
+            {
+                if (is_ident_start(token[0]))
+                {
+                    d.kernel = d.kernel || token == "kernel" || token == "__kernel";
+                    last = token;
+                }
+                // only a body right after the parameter list, and its attributes, makes a definition
+                parameters = parameters && is_ident_start(token[0]);
+                i = end;
+            }
+            i = skip_blanks(src, i);
+        }
+        d.end = i;
+        d.kernel = d.kernel && !d.function.empty();
+        declarations.push_back(d);
+        i = skip_blanks(src, i);
+    }
+    return declarations;
+}
+
+/** Collects the identifiers of a source text range, conservatively, comments and literals included
+ * @param[in] src Source text
+ * @param[in] begin Range start
+ * @param[in] end Range end
+ * @param[in,out] identifiers Receives the identifiers
+ */
+void collect_identifiers(const std::string &src, size_t begin, size_t end, std::set<std::string> &identifiers)
+{
+    for (size_t i = begin; i < end;)
+    {
+        if (!is_ident_start(src[i]) || (i > begin && is_ident(src[i - 1])))
+        {
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        while (i < end && is_ident(src[i]))
+        {
+            ++i;
+        }
+        identifiers.insert(src.substr(start, i - start));
+    }
+}
+
+/** Blanks out source text ranges, keeping their line breaks
+ * @param[in] src Source text
+ * @param[in] drop Ranges to drop, ordered and disjoint
+ * @return The source text without the ranges
+ */
+std::string drop_ranges(const std::string &src, const std::vector<std::pair<size_t, size_t>> &drop)
+{
+    std::string out;
+    out.reserve(src.size());
+
+    size_t copied = 0;
+    for (const auto &r : drop)
+    {
+        out.append(src, copied, r.first - copied);
+        out.append(std::count(src.begin() + r.first, src.begin() + r.second, '\n'), '\n');
+        copied = r.second;
+    }
+    out.append(src, copied, std::string::npos);
+    return out;
+}
+
+/** Preprocessor directive found in a source text */
+struct directive
+{
+    /** directive name, e.g. "define" */
+    std::string name;
+
+    /** first identifier following the name, e.g. the macro name of a define */
+    std::string argument;
+
+    /** rest of the directive, e.g. the parameters and replacement of a define */
+    std::string value;
+};
+
+/** Lists the preprocessor directives of a source text
+ * @param[in] src Source text
+ * @return The directives, in order
+ */
+std::vector<directive> find_directives(const std::string &src)
+{
+    std::vector<directive> directives;
+    const size_t n = src.size();
+    bool line_start = true;
+    for (size_t i = 0; i < n;)
+    {
+        char c = src[i];
+        if (c == '\n')
+        {
+            line_start = true;
+            ++i;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+        {
+            ++i;
+        }
+        else if (c == '/' && i + 1 < n && src[i + 1] == '/')
+        {
+            size_t end = src.find('\n', i);
+            i = end == std::string::npos ? n : end;
+        }
+        else if (c == '/' && i + 1 < n && src[i + 1] == '*')
+        {
+            size_t end = src.find("*/", i + 2);
+            i = end == std::string::npos ? n : end + 2;
+        }
+        else if (c == '#' && line_start)
+        {
+            size_t end = i;
+            while (end < n && src[end] != '\n')
+            {
+                end += src[end] == '\\' && end + 1 < n ? 2 : 1;
+            }
+            directive d;
+            for (size_t j = i + 1; j < end;)
+            {
+                if (is_ident_start(src[j]))
+                {
+                    size_t k = skip_token(src, j);
+                    (d.name.empty() ? d.name : d.argument) = src.substr(j, k - j);
+                    if (!d.argument.empty())
+                    {
+                        d.value = src.substr(k, end - k);
+                        break;
+                    }
+                    j = k;
+                }
+                else if (src[j] == ' ' || src[j] == '\t' || src[j] == '\\' || src[j] == '\n')
+                {
+                    ++j;
+                }
+                else
+                {
+                    break;
+                }
+            }
+            directives.push_back(d);
+            i = end;
+        }
+        else
+        {
+            line_start = false;
+            i = skip_token(src, i);
+        }
+    }
+    return directives;
+}
+
+/** @return Whether an identifier is a keyword that may precede a declared name */
+bool is_declaration_keyword(const std::string &token)
+{
+    return token == "struct" || token == "union" || token == "enum" || token == "__attribute__";
+}
+
+} // namespace
+
+std::string normalize_source(const std::string &src)
+{
+    std::string out;
+    out.reserve(src.size());
+
+    // pending whitespace, emitted only if followed by a token on the same line
+    bool space = false;
+    // whether nothing but whitespace was emitted since the last line break
+    bool bol = true;
+    auto flush = [&out, &space, &bol]()
+    {
+        if (space && !bol)
+        {
+            out += ' ';
+        }
+        space = false;
+    };
+
+    const size_t n = src.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        char c = src[i];
+        if (c == '\\' && i + 1 < n && src[i + 1] == '\n')
+        {
+            // line continuation, kept so that the following lines keep their numbers
+            ++i;
+            flush();
+            out += "\\\n";
+        }
+        else if (c == '/' && i + 1 < n && src[i + 1] == '/')
+        {
+            while (i + 1 < n && src[i + 1] != '\n')
+            {
+                ++i;
+            }
+        }
+        else if (c == '/' && i + 1 < n && src[i + 1] == '*')
+        {
+            size_t end = src.find("*/", i + 2);
+            end = end == std::string::npos ? n : end + 2;
+            space = true;
+            // the comment line breaks are kept as continuations, the comment may be part of a directive
+            for (size_t k = i + 2; k < end; ++k)
+            {
+                if (src[k] == '\n')
+                {
+                    flush();
+                    out += "\\\n";
+                    space = true;
+                }
+            }
+            i = end - 1;
+        }
+        else if (c == '\n')
+        {
+            out += '\n';
+            space = false;
+            bol = true;
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+        {
+            space = true;
+        }
+        else
+        {
+            flush();
+            bol = false;
+
+            out += c;
+            if (c == '"' || c == '\'')
+            {
+                // copy the literal as is, up to its unescaped closing quote
+                for (++i; i < n && src[i] != c && src[i] != '\n'; ++i)
+                {
+                    out += src[i];
+                    if (src[i] == '\\' && i + 1 < n)
+                    {
+                        out += src[++i];
+                    }
+                }
+                if (i < n && src[i] == c)
+                {
+                    out += c;
+                }
+                else
+                {
+                    --i;
+                }
+            }
+        }
+    }
+
+    if (!out.empty() && out.back() != '\n')
+    {
+        out += '\n';
+    }
+    return out;
+}
+
+std::vector<std::string> kernel_names(const std::string &src)
+{
+    std::vector<std::string> names;
+    for (const kernel_definition &k : find_kernels(src))
+    {
+        if (k.has_body)
+        {
+            names.push_back(k.name);
+        }
+    }
+    return names;
+}
+
+std::string select_kernels(const std::string &src, const std::set<std::string> &kernels)
+{
+    const std::vector<kernel_definition> definitions = find_kernels(src);
+
+    // kernels may call other kernels, those called by the kept ones are kept as well
+    std::set<std::string> kept(kernels);
+    for (bool grown = true; grown;)
+    {
+        grown = false;
+        std::set<std::string> referenced;
+        for (const kernel_definition &k : definitions)
+        {
+            if (kept.count(k.name))
+            {
+                collect_identifiers(src, k.begin, k.end, referenced);
+            }
+        }
+        for (const kernel_definition &k : definitions)
+        {
+            if (referenced.count(k.name) && kept.insert(k.name).second)
+            {
+                grown = true;
+            }
+        }
+    }
+
+    std::string out;
+    out.reserve(src.size());
+
+    size_t copied = 0;
+    for (const kernel_definition &k : definitions)
+    {
+        if (kept.count(k.name))
+        {
+            continue;
+        }
+        out.append(src, copied, k.begin - copied);
+        out.append(std::count(src.begin() + k.begin, src.begin() + k.end, '\n'), '\n');
+        copied = k.end;
+    }
+    out.append(src, copied, std::string::npos);
+    return out;
+}
+
+std::string extract_kernels(const std::string &src, const std::set<std::string> &kernels,
+                            std::vector<std::string> *helpers)
+{
+    const std::vector<declaration> declarations = find_declarations(src);
+
+    // everything but the function definitions is kept, so are the functions it may refer to, macros included
+    std::set<std::string> referenced;
+    std::multimap<std::string, const declaration *> functions;
+    size_t previous = 0;
+    for (const declaration &d : declarations)
+    {
+        collect_identifiers(src, previous, d.begin, referenced);
+        if (d.function.empty())
+        {
+            collect_identifiers(src, d.begin, d.end, referenced);
+        }
+        else if (d.kernel && kernels.count(d.function))
+        {
+            collect_identifiers(src, d.begin, d.end, referenced);
+        }
+        else
+        {
+            // the other kernels are indexed along with the helpers, the kept code may call them too
+            functions.insert(std::make_pair(d.function, &d));
+        }
+        previous = d.end;
+    }
+    collect_identifiers(src, previous, src.size(), referenced);
+
+    // helpers and kernels reachable from the kept code
+    std::set<const declaration *> kept;
+    std::vector<std::string> pending(referenced.begin(), referenced.end());
+    while (!pending.empty())
+    {
+        std::string name = pending.back();
+        pending.pop_back();
+        auto range = functions.equal_range(name);
+        for (auto f = range.first; f != range.second; ++f)
+        {
+            if (kept.insert(f->second).second)
+            {
+                std::set<std::string> more;
+                collect_identifiers(src, f->second->begin, f->second->end, more);
+                for (const std::string &m : more)
+                {
+                    if (referenced.insert(m).second)
+                    {
+                        pending.push_back(m);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<std::pair<size_t, size_t>> drop;
+    for (const declaration &d : declarations)
+    {
+        if (d.function.empty() || (d.kernel && kernels.count(d.function)))
+        {
+            continue;
+        }
+        if (kept.count(&d))
+        {
+            if (helpers && !d.kernel)
+            {
+                helpers->push_back(d.function);
+            }
+            continue;
+        }
+        drop.push_back(std::make_pair(d.begin, d.end));
+    }
+    return drop_ranges(src, drop);
+}
+
+bool declared_names(const std::string &src, std::set<std::string> &names)
+{
+    for (const directive &d : find_directives(src))
+    {
+        if (d.name == "include" || d.name == "import")
+        {
+            return false;
+        }
+        // macros do not outlive their source, see coalesce_sources, but may alias the name of a declaration
+        size_t first = d.value.find_first_not_of(" \t\\\n");
+        if (d.name == "define" && !d.value.empty() && d.value[0] != '(' && first != std::string::npos &&
+            is_ident_start(d.value[first]))
+        {
+            size_t last = skip_token(d.value, first);
+            if (d.value.find_first_not_of(" \t\r\\\n", last) == std::string::npos)
+            {
+                names.insert(d.value.substr(first, last - first));
+            }
+        }
+    }
+
+    for (const declaration &d : find_declarations(src))
+    {
+        if (!d.function.empty())
+        {
+            names.insert(d.function);
+            continue;
+        }
+
+        // the identifier before a declarator ends, initializers and attributes skipped
+        std::string last;
+        bool enumeration = false;
+        bool initializer = false;
+        for (size_t i = d.begin; i < d.end; i = skip_blanks(src, i))
+        {
+            size_t end = skip_token(src, i);
+            std::string token = src.substr(i, end - i);
+            if (is_ident_start(token[0]))
+            {
+                enumeration = enumeration || token == "enum";
+                last = initializer || is_declaration_keyword(token) ? std::string() : token;
+                i = end;
+                continue;
+            }
+            if (token == "(" || token == "{")
+            {
+                end = skip_group(src, i);
+                if (token == "{" && enumeration && !initializer)
+                {
+                    // the enumerators are conservatively taken as declared, their values included
+                    collect_identifiers(src, i, end, names);
+                }
+            }
+            if (!last.empty() && (token == "(" || token == "{" || token == "[" || token == "=" || token == "," ||
+                                  token == ";"))
+            {
+                names.insert(last);
+            }
+            last.clear();
+            initializer = (initializer || token == "=") && token != ",";
+            i = end;
+        }
+    }
+    return true;
+}
+
+bool has_extension_pragmas(const std::string &src)
+{
+    for (const directive &d : find_directives(src))
+    {
+        if (d.name == "pragma" && d.argument == "OPENCL" && d.value.find("EXTENSION") != std::string::npos)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string coalesce_sources(const std::vector<std::string> &filenames, const std::vector<std::string> &sources)
+{
+    std::string out;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        std::string fn;
+        for (char c : filenames[i])
+        {
+            fn += c == '"' || c == '\\' ? std::string("\\") + c : std::string(1, c);
+        }
+        out += "#line 1 \"" + fn + "\"\n";
+        out += sources[i];
+        if (!sources[i].empty() && sources[i].back() != '\n')
+        {
+            out += '\n';
+        }
+
+        std::set<std::string> macros;
+        for (const directive &d : find_directives(sources[i]))
+        {
+            if (d.name == "define" && !d.argument.empty())
+            {
+                macros.insert(d.argument);
+            }
+        }
+        for (const std::string &m : macros)
+        {
+            out += "#undef " + m + "\n";
+        }
+    }
+    return out;
+}
+
+std::string specialize_source(const std::string &src, const std::map<std::string, std::vector<size_t>> &sizes)
+{
+    std::string out;
+    out.reserve(src.size());
+
+    size_t copied = 0;
+    for (const kernel_definition &k : find_kernels(src))
+    {
+        auto found = sizes.find(k.name);
+        if (found == sizes.end() || k.has_reqd_size)
+        {
+            continue;
+        }
+
+        const std::vector<size_t> &size = found->second;
+        out.append(src, copied, k.qualifier_end - copied);
+        out += " __attribute__((reqd_work_group_size(";
+        for (size_t d = 0; d < 3; ++d)
+        {
+            out += d ? ", " : "";
+            out += std::to_string(d < size.size() ? size[d] : 1);
+        }
+        out += ")))";
+        copied = k.qualifier_end;
+    }
+    out.append(src, copied, std::string::npos);
+    return out;
+}
+
+} // namespace clc
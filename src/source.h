@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef source_h
+#define source_h
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Normalizes an OpenCL C source text so that lexically equivalent sources compare equal
+ *
+ * Comments are removed and runs of whitespace within a line are collapsed into a single space. Every line break is
+ * kept, blank lines included, and those of comments spanning several lines become line continuations, so that
+ * preprocessor directives, @c __LINE__, diagnostics and debug information are the same for equal normalized texts.
+ * String and character literals are left untouched.
+ *
+ * @param[in] src Source text
+ * @return The normalized source text
+ */
+std::string normalize_source(const std::string &src);
+
+/** Lists the kernels defined by an OpenCL C source text
+ *
+ * Kernel declarations without a body are skipped. Kernels declared through macros are not found, the preprocessor
+ * directives being skipped.
+ *
+ * @param[in] src Source text
+ * @return The kernel names, in order of definition
+ */
+std::vector<std::string> kernel_names(const std::string &src);
+
+/** Keeps some of the kernels of an OpenCL C source text, dropping the others
+ *
+ * The definitions of the other kernels are replaced by their line breaks, so that build logs still point at the right
+ * lines. Everything else, helper functions included, is kept, and so are the kernels the kept ones call.
+ *
+ * @param[in] src Source text
+ * @param[in] kernels Names of the kernels to keep
+ * @return The source text defining only those kernels and the kernels they call
+ */
+std::string select_kernels(const std::string &src, const std::set<std::string> &kernels);
+
+/** Keeps some of the kernels of an OpenCL C source text and the helper functions they depend on
+ *
+ * Function definitions are dropped unless they are one of the kernels, or a helper function or kernel the kept code
+ * refers to, directly or through other functions. Everything else is kept: types, global constants, declarations, and
+ * macros along with the functions they refer to. Identifiers are collected conservatively, any mention of a function
+ * name keeping it. Dropped definitions are replaced by their line breaks, see @ref select_kernels.
+ *
+ * @param[in] src Source text
+ * @param[in] kernels Names of the kernels to keep
+ * @param[out] helpers When not null, receives the names of the helper functions kept
+ * @return The source text defining only those kernels and their helpers
+ */
+std::string extract_kernels(const std::string &src, const std::set<std::string> &kernels,
+                            std::vector<std::string> *helpers = nullptr);
+
+/** Lists the names a source text declares at file scope
+ *
+ * Names are collected conservatively: functions, prototypes included, variables, types, struct, union and enum tags,
+ * enumerators, and the identifiers macros are defined as. Macro names are left out as @ref coalesce_sources keeps them
+ * from leaking into other sources.
+ *
+ * @param[in] src Source text
+ * @param[in,out] names Receives the declared names
+ * @return true if succeeded, false if the source includes other files, whose names cannot be known
+ */
+bool declared_names(const std::string &src, std::set<std::string> &names);
+
+/** Tells whether a source text changes the state of OpenCL extensions
+ *
+ * An extension enabled by a "#pragma OPENCL EXTENSION" stays enabled for the rest of the program, disabling it again
+ * does not restore the default state of the extensions that are core features, so such sources cannot be coalesced.
+ *
+ * @param[in] src Source text
+ * @return true if the source holds an OPENCL EXTENSION pragma, false otherwise
+ */
+bool has_extension_pragmas(const std::string &src);
+
+/** Concatenates source texts into a single program
+ *
+ * Each source is preceded by a #line directive naming its file, so that build logs point at the original lines, and
+ * followed by the #undef of the macros it defines, so that they do not leak into the following sources.
+ *
+ * @param[in] filenames Filename of each source
+ * @param[in] sources Source texts, their declared names must not conflict, see @ref declared_names, and they must not
+ * change the state of extensions, see @ref has_extension_pragmas
+ * @return The combined source text
+ */
+std::string coalesce_sources(const std::vector<std::string> &filenames, const std::vector<std::string> &sources);
+
+/** Adds a reqd_work_group_size attribute to kernels of an OpenCL C source text
+ *
+ * Kernels that already carry a reqd_work_group_size attribute are left untouched.
+ *
+ * @param[in] src Source text
+ * @param[in] sizes Work-group size of each kernel to specialize, keyed by kernel name, missing dimensions being 1
+ * @return The specialized source text
+ */
+std::string specialize_source(const std::string &src, const std::map<std::string, std::vector<size_t>> &sizes);
+
+} // namespace clc
+
+#endif // source_h
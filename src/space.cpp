@@ -0,0 +1,449 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "space.h"
+#include "clc.h"
+#include "file.h"
+#include "hash.h"
+#include "log.h"
+#include "parallel.h"
+#include "scope_guard.h"
+#include "source.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Minimum relative improvement for the search to move to a neighbour */
+const double min_gain = 0.01;
+
+/** Evaluation of a configuration */
+struct evaluation
+{
+    /** sum of the median times of the kernels, negative if failed */
+    double seconds = -1;
+
+    /** time the configuration was pruned against after a single run, @ref seconds then being that run, 0 if the
+     * configuration completed its runs */
+    double bound = 0;
+};
+
+/** Evaluations of previous and current tunings, see @ref tune_space */
+class checkpoint
+{
+  public:
+    checkpoint() = default;
+    ~checkpoint()
+    {
+        if (m_file)
+        {
+            std::fclose(m_file);
+        }
+    }
+
+    checkpoint(const checkpoint &) = delete;
+    checkpoint &operator=(const checkpoint &) = delete;
+
+    /** Loads the evaluations recorded so far and opens the checkpoint for appending
+     * @param[in] fn Checkpoint filename
+     * @return true if succeeded, false otherwise
+     */
+    bool open(const std::string &fn)
+    {
+        std::ifstream in(fn);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::vector<std::string> fields = split_fields(line);
+            if (fields.size() == 4 || fields.size() == 5)
+            {
+                evaluation e;
+                e.seconds = std::strtod(fields[1].c_str(), nullptr);
+                e.bound = fields.size() == 5 ? std::strtod(fields[4].c_str(), nullptr) : 0;
+                m_evaluations[key(std::strtoull(fields[0].c_str(), nullptr, 16), fields[2], fields[3])] = e;
+            }
+        }
+
+        m_file = std::fopen(fn.c_str(), "a");
+        if (!m_file)
+        {
+            logerr("failed opening the checkpoint \"%s\"\n", fn.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /** Looks an evaluation up
+     * @param[in] hash Source hash
+     * @param[in] identity Device identity
+     * @param[in] options Build options
+     * @param[out] e Receives the evaluation
+     * @return true if found, false otherwise
+     */
+    bool find(uint64_t hash, const std::string &identity, const std::string &options, evaluation &e) const
+    {
+        auto found = m_evaluations.find(key(hash, identity, options));
+        if (found == m_evaluations.end())
+        {
+            return false;
+        }
+        e = found->second;
+        return true;
+    }
+
+    /** Records an evaluation, flushed right away so that it survives an interruption
+     * @param[in] hash Source hash
+     * @param[in] identity Device identity
+     * @param[in] options Build options
+     * @param[in] e Evaluation
+     */
+    void record(uint64_t hash, const std::string &identity, const std::string &options, const evaluation &e)
+    {
+        m_evaluations[key(hash, identity, options)] = e;
+        if (m_file)
+        {
+            std::fprintf(m_file, "%s\t%.9f\t%s\t%s", hash_str(hash).c_str(), e.seconds, identity.c_str(),
+                         options.c_str());
+            if (e.bound > 0)
+            {
+                std::fprintf(m_file, "\t%.9f", e.bound);
+            }
+            std::fprintf(m_file, "\n");
+            std::fflush(m_file);
+        }
+    }
+
+  private:
+    /** @return The lookup key of an evaluation */
+    static std::string key(uint64_t hash, const std::string &identity, const std::string &options)
+    {
+        return hash_str(hash) + '\t' + identity + '\t' + options;
+    }
+
+    /** evaluations keyed by source hash, device identity and build options */
+    std::map<std::string, evaluation> m_evaluations;
+
+    /** checkpoint file, nullptr when not recording */
+    FILE *m_file = nullptr;
+};
+
+/** Appends build options to others
+ * @param[in] options Build options
+ * @param[in] more Build options to append
+ * @return The combined build options
+ */
+std::string join(const std::string &options, const std::string &more)
+{
+    return options.empty() || more.empty() ? options + more : options + ' ' + more;
+}
+
+/** Benchmarks the kernels of a program
+ *
+ * @param[in] runner Kernel runner of the device
+ * @param[in] program Built program
+ * @param[in] specs Kernel specs
+ * @param[in] runs Number of timed runs per kernel
+ * @param[in] bound Time beyond which the program is pruned after a single run of each kernel, 0 for no pruning
+ * @return The evaluation, its single run time along with @p bound if pruned
+ */
+evaluation evaluate(const kernel_runner &runner, cl_program program, const std::vector<kernel_spec> &specs,
+                    unsigned runs, double bound)
+{
+    evaluation e;
+    std::vector<const kernel_spec *> kernels;
+    for (const std::string &name : get_kernel_names(program))
+    {
+        auto spec =
+            std::find_if(specs.begin(), specs.end(), [&name](const kernel_spec &s) { return s.kernel == name; });
+        if (spec != specs.end())
+        {
+            kernels.push_back(&*spec);
+        }
+    }
+    if (kernels.empty())
+    {
+        logerr("no kernel with a spec to evaluate\n");
+        return e;
+    }
+
+    kernel_timing timing;
+    if (bound > 0)
+    {
+        double first = 0;
+        for (const kernel_spec *spec : kernels)
+        {
+            if (!runner.run(program, *spec, 1, timing))
+            {
+                return e;
+            }
+            first += timing.median;
+        }
+        if (first > bound)
+        {
+            e.seconds = first;
+            e.bound = bound;
+            return e;
+        }
+    }
+
+    double total = 0;
+    for (const kernel_spec *spec : kernels)
+    {
+        if (!runner.run(program, *spec, runs, timing))
+        {
+            return e;
+        }
+        total += timing.median;
+    }
+    e.seconds = total;
+    return e;
+}
+
+/** Lists the configurations moving one macro to a neighbouring value
+ * @param[in] shape Number of values of each macro
+ * @param[in] point Configuration
+ * @return The neighbours of @p point
+ */
+std::vector<std::vector<size_t>> neighbours(const std::vector<size_t> &shape, const std::vector<size_t> &point)
+{
+    std::vector<std::vector<size_t>> found;
+    for (size_t d = 0; d < shape.size(); ++d)
+    {
+        if (point[d] > 0)
+        {
+            found.push_back(point);
+            --found.back()[d];
+        }
+        if (point[d] + 1 < shape[d])
+        {
+            found.push_back(point);
+            ++found.back()[d];
+        }
+    }
+    return found;
+}
+
+/** Writes the best configurations as a manifest
+ * @param[in] fn Manifest filename
+ * @param[in] lines Manifest lines
+ * @return true if succeeded, false otherwise
+ */
+bool write_manifest(const std::string &fn, const std::vector<std::string> &lines)
+{
+    std::string tmp_fn = fn + ".tmp";
+    FILE *f = std::fopen(tmp_fn.c_str(), "w");
+    if (!f)
+    {
+        logerr("failed creating the manifest \"%s\"\n", tmp_fn.c_str());
+        return false;
+    }
+
+    bool written = true;
+    for (const std::string &line : lines)
+    {
+        written = written && std::fprintf(f, "%s\n", line.c_str()) > 0;
+    }
+
+    if (std::fclose(f) != 0 || !written || std::rename(tmp_fn.c_str(), fn.c_str()) != 0)
+    {
+        logerr("failed writing the manifest \"%s\"\n", fn.c_str());
+        std::remove(tmp_fn.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool tune_space(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<cl_uint> &device_ids,
+                const std::vector<build_input> &inputs, const std::vector<kernel_spec> &specs,
+                const define_matrix &space, const space_tuning &settings)
+{
+    std::vector<std::unique_ptr<kernel_runner>> runners;
+    for (const auto &c : compilers)
+    {
+        runners.emplace_back(new kernel_runner);
+        if (!runners.back()->init(*c))
+        {
+            return false;
+        }
+    }
+
+    checkpoint evaluations;
+    if (!settings.checkpoint.empty() && !evaluations.open(settings.checkpoint))
+    {
+        return false;
+    }
+
+    const std::vector<size_t> shape = space.shape();
+    size_t space_size = 1;
+    for (size_t n : shape)
+    {
+        space_size *= n;
+    }
+
+    bool ok = true;
+    std::vector<std::string> manifest;
+    for (const build_input &input : inputs)
+    {
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            ok = false;
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+        const uint64_t hash = fnv1a64(normalize_source(text));
+
+        for (size_t d = 0; d < compilers.size(); ++d)
+        {
+            if (!input.builders.empty() &&
+                std::find(input.builders.begin(), input.builders.end(), d) == input.builders.end())
+            {
+                continue;
+            }
+            const compiler &c = *compilers[d];
+
+            // evaluations of this search, negative if failed
+            std::map<std::vector<size_t>, double> costs;
+            std::vector<size_t> start(shape.size());
+            for (size_t m = 0; m < shape.size(); ++m)
+            {
+                start[m] = (shape[m] - 1) / 2;
+            }
+            std::vector<size_t> current = start;
+            std::vector<std::vector<size_t>> pending = neighbours(shape, current);
+            pending.insert(pending.begin(), current);
+            double best = 0;
+
+            while (!pending.empty())
+            {
+                if (settings.budget && costs.size() + pending.size() > settings.budget)
+                {
+                    pending.resize(settings.budget - costs.size());
+                }
+
+                // the configurations missing from the checkpoint build concurrently, as do the ones it pruned against a
+                // lower bound than the current one, which are only known to be slower than that bound
+                double bound = 2 * best;
+                std::vector<std::string> options(pending.size());
+                std::vector<cl_program> programs(pending.size(), nullptr);
+                std::vector<size_t> missing;
+                for (size_t i = 0; i < pending.size(); ++i)
+                {
+                    options[i] = join(input.options, space.variant(pending[i]).options);
+                    evaluation e;
+                    if (!evaluations.find(hash, c.identity(), options[i], e) ||
+                        (e.bound > 0 && (bound <= 0 || bound > e.bound)))
+                    {
+                        missing.push_back(i);
+                    }
+                    costs[pending[i]] = e.seconds;
+                }
+                on_scope_guard([&programs]() {
+                    for (cl_program p : programs)
+                    {
+                        if (p)
+                        {
+                            clReleaseProgram(p);
+                        }
+                    }
+                });
+                parallel_for(missing.size(), settings.jobs, [&](size_t i) {
+                    programs[missing[i]] = c.build_program(text.c_str(), options[missing[i]].c_str());
+                });
+                for (size_t i : missing)
+                {
+                    evaluation e;
+                    if (programs[i])
+                    {
+                        e = evaluate(*runners[d], programs[i], specs, settings.runs, bound);
+                    }
+                    if (e.bound > 0)
+                    {
+                        loginfo("pruned \"%s\" for \"%s\"\n", options[i].c_str(), input.filename.c_str());
+                    }
+                    costs[pending[i]] = e.seconds;
+                    evaluations.record(hash, c.identity(), options[i], e);
+                }
+
+                if (best <= 0 && costs[current] > 0)
+                {
+                    best = costs[current];
+                }
+
+                // moves to the fastest neighbour, if improving enough
+                std::vector<size_t> next = current;
+                double next_cost = best > 0 ? best * (1 - min_gain) : 0;
+                for (const std::vector<size_t> &p : pending)
+                {
+                    double cost = costs[p];
+                    if (cost >= 0 && (next_cost <= 0 || cost < next_cost))
+                    {
+                        next = p;
+                        next_cost = cost;
+                    }
+                }
+                if (next == current)
+                {
+                    break;
+                }
+                current = next;
+                best = next_cost;
+
+                pending.clear();
+                if (!settings.budget || costs.size() < settings.budget)
+                {
+                    for (const std::vector<size_t> &p : neighbours(shape, current))
+                    {
+                        if (!costs.count(p))
+                        {
+                            pending.push_back(p);
+                        }
+                    }
+                }
+            }
+
+            if (best <= 0)
+            {
+                logerr("no configuration of \"%s\" could be evaluated\n", input.filename.c_str());
+                ok = false;
+                continue;
+            }
+
+            // the reference is omitted when the start configuration failed or was pruned
+            std::string reference;
+            auto start_cost = costs.find(start);
+            if (start_cost != costs.end() && start_cost->second > 0)
+            {
+                char buf[64];
+                std::snprintf(buf, sizeof(buf), " reference_us=%.3f speedup=%.2f", start_cost->second * 1e6,
+                              start_cost->second / best);
+                reference = buf;
+            }
+            std::string defines = space.variant(current).options;
+            std::printf("tune: program=%s device=\"%s\" defines=\"%s\" median_us=%.3f%s evaluations=%zu space=%zu\n",
+                        input.name.c_str(), c.identity().c_str(), defines.c_str(), best * 1e6, reference.c_str(),
+                        costs.size(), space_size);
+            manifest.push_back(input.filename + '\t' + join(input.options, defines) + '\t' + input.name + '\t' +
+                               std::to_string(device_ids[d]));
+        }
+    }
+
+    if (!settings.manifest.empty() && !write_manifest(settings.manifest, manifest))
+    {
+        return false;
+    }
+    return ok;
+}
+
+} // namespace clc
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef space_h
+#define space_h
+
+#include "bench.h"
+#include "driver.h"
+#include "matrix.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+class compiler;
+
+/** Settings of the parameter space tuner */
+struct space_tuning
+{
+    /** Number of timed runs per kernel and configuration */
+    unsigned runs = 10;
+
+    /** Maximum number of concurrent configuration builds */
+    unsigned jobs = 1;
+
+    /** Maximum number of configurations evaluated per program and device, 0 for no limit */
+    unsigned budget = 0;
+
+    /** File recording every evaluated configuration so that an interrupted tuning resumes, empty for none */
+    std::string checkpoint;
+
+    /** Manifest receiving the best configuration of each program and device, empty for none, see
+     * @ref load_manifest */
+    std::string manifest;
+};
+
+/** Searches the fastest configuration of the tunable macros of every input on every device it targets
+ *
+ * The search is a hill climb over the values of the macros in the order they were listed, starting from the middle
+ * value of each macro. Each step evaluates the configurations moving one macro to a neighbouring value, building them
+ * concurrently and benchmarking them one at a time with the @ref kernel_runner, then moves to the fastest one. The
+ * search stops once no neighbour improves on the current configuration by more than 1%, or once the budget is spent.
+ *
+ * Configurations are evaluated by the sum of the median times of the kernels of the program. A configuration whose
+ * first run is more than twice as slow as the best one so far is pruned without completing its runs.
+ *
+ * The evaluations are appended to the checkpoint as they complete, as tab separated fields:
+ *
+ *     <source hash><TAB><seconds, negative if failed><TAB><device identity><TAB><build options>[<TAB><bound>]
+ *
+ * so that a tuning started again replays the evaluations it already made rather than repeating them. Pruned
+ * configurations record their single run along with the bound they were pruned against, and are evaluated again by a
+ * tuning pruning against a higher bound.
+ *
+ * @param[in] compilers Compiler of each device, indexed like the @ref build_input::builders
+ * @param[in] device_ids Device index of each compiler, for the manifest
+ * @param[in] inputs Inputs to tune, their build options are kept in every configuration
+ * @param[in] specs Kernel specs, see @ref load_kernel_specs
+ * @param[in] space Tunable macros and their values, see @ref define_matrix
+ * @param[in] settings Tuning settings
+ * @return true if every input was tuned, false otherwise
+ */
+bool tune_space(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<cl_uint> &device_ids,
+                const std::vector<build_input> &inputs, const std::vector<kernel_spec> &specs,
+                const define_matrix &space, const space_tuning &settings);
+
+} // namespace clc
+
+#endif // space_h
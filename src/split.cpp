@@ -0,0 +1,333 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "split.h"
+#include "file.h"
+#include "log.h"
+#include "parallel.h"
+#include "source.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <utility>
+
+namespace clc
+{
+
+bool attribute_build_times(const std::vector<std::unique_ptr<device_builder>> &builders,
+                           const std::vector<build_input> &inputs, unsigned jobs)
+{
+    /** Build of a program or of one of its kernels, an empty kernel name standing for the whole program */
+    struct timed_build
+    {
+        size_t input = 0;
+        size_t builder = 0;
+        std::string kernel;
+        std::string source;
+        build_result result = build_result::failed;
+        double seconds = 0;
+        size_t binary_size = 0;
+    };
+
+    bool ok = true;
+    std::vector<timed_build> builds;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        const build_input &input = inputs[i];
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            ok = false;
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+
+        std::vector<std::string> kernels = kernel_names(text);
+        for (size_t b = 0; b < builders.size(); ++b)
+        {
+            if (!input.builders.empty() &&
+                std::find(input.builders.begin(), input.builders.end(), b) == input.builders.end())
+            {
+                continue;
+            }
+
+            timed_build whole;
+            whole.input = i;
+            whole.builder = b;
+            whole.source = text;
+            builds.push_back(whole);
+            for (const std::string &kernel : kernels)
+            {
+                timed_build k = whole;
+                k.kernel = kernel;
+                k.source = select_kernels(text, {kernel});
+                builds.push_back(std::move(k));
+            }
+        }
+    }
+
+    parallel_for(builds.size(), jobs, [&](size_t n) {
+        timed_build &t = builds[n];
+        std::vector<unsigned char> binary;
+        auto start = std::chrono::steady_clock::now();
+        t.result = builders[t.builder]->build(t.source, inputs[t.input].options, &binary);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        t.seconds = elapsed.count();
+        t.binary_size = binary.size();
+        t.source.clear();
+    });
+
+    // the whole program comes first, then its kernels from the slowest to build
+    std::stable_sort(builds.begin(), builds.end(), [](const timed_build &a, const timed_build &b) {
+        if (a.input != b.input || a.builder != b.builder)
+        {
+            return a.input != b.input ? a.input < b.input : a.builder < b.builder;
+        }
+        if (a.kernel.empty() != b.kernel.empty())
+        {
+            return a.kernel.empty();
+        }
+        return a.seconds > b.seconds;
+    });
+
+    for (const timed_build &t : builds)
+    {
+        const build_input &input = inputs[t.input];
+        if (t.result != build_result::success)
+        {
+            if (t.kernel.empty())
+            {
+                logerr("failed building \"%s\"\n", input.filename.c_str());
+            }
+            else
+            {
+                logerr("failed building the kernel \"%s\" of \"%s\" alone\n", t.kernel.c_str(),
+                       input.filename.c_str());
+            }
+            ok = false;
+            continue;
+        }
+        std::printf("build_time: program=%s kernel=%s device=\"%s\" seconds=%.3f binary_bytes=%zu\n",
+                    input.name.c_str(), t.kernel.empty() ? "*" : t.kernel.c_str(),
+                    builders[t.builder]->identity().c_str(), t.seconds, t.binary_size);
+    }
+    return ok;
+}
+
+void split_inputs(std::vector<build_input> &inputs, unsigned partitions,
+                  std::map<std::string, std::map<std::string, std::string>> &maps)
+{
+    std::vector<build_input> split;
+    for (build_input &input : inputs)
+    {
+        // unreadable inputs are kept as is, their build reports the failure
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            split.push_back(std::move(input));
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+
+        std::vector<std::string> kernels = kernel_names(text);
+        if (partitions < 2 || kernels.size() < 2 || !input.kernels.empty())
+        {
+            split.push_back(std::move(input));
+            continue;
+        }
+
+        // longest processing time first, the most costly kernel goes to the least loaded partition
+        std::vector<std::pair<size_t, std::string>> costs;
+        for (const std::string &kernel : kernels)
+        {
+            costs.push_back(std::make_pair(normalize_source(extract_kernels(text, {kernel})).size(), kernel));
+        }
+        std::stable_sort(costs.begin(), costs.end(),
+                         [](const std::pair<size_t, std::string> &a, const std::pair<size_t, std::string> &b) {
+                             return a.first > b.first;
+                         });
+
+        std::vector<build_input> parts(std::min<size_t>(partitions, kernels.size()), input);
+        std::vector<size_t> loads(parts.size());
+        for (const auto &c : costs)
+        {
+            size_t p = std::min_element(loads.begin(), loads.end()) - loads.begin();
+            loads[p] += c.first;
+            parts[p].kernels.insert(c.second);
+        }
+
+        std::map<std::string, std::string> &map = maps[input.name];
+        for (size_t p = 0; p < parts.size(); ++p)
+        {
+            parts[p].name = input.name + ".part" + std::to_string(p);
+            for (const std::string &kernel : parts[p].kernels)
+            {
+                map[kernel] = parts[p].name;
+            }
+            split.push_back(std::move(parts[p]));
+        }
+    }
+    inputs = std::move(split);
+}
+
+void coalesce_inputs(std::vector<build_input> &inputs, size_t max_bytes,
+                     std::map<std::string, std::map<std::string, std::string>> &maps)
+{
+    /** Combined program */
+    struct combined
+    {
+        std::vector<size_t> members;
+        std::set<std::string> names;
+        size_t bytes = 0;
+    };
+
+    std::vector<build_input> kept;
+    std::vector<combined> programs;
+    std::vector<std::vector<std::string>> kernels(inputs.size());
+    // duplicates of the coalesced inputs, with the index of the first one
+    std::vector<std::pair<size_t, size_t>> duplicates;
+    std::map<std::string, size_t> coalesced;
+    std::vector<size_t> program_of(inputs.size());
+
+    // the sources are loaded in batches, see load_files
+    const size_t batch = 64;
+    std::vector<const char *> fns;
+    std::vector<size_t> loaded;
+    std::vector<char *> sources;
+    std::vector<char *> batch_sources;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (i % batch == 0)
+        {
+            size_t last = std::min(i + batch, inputs.size());
+            fns.clear();
+            loaded.clear();
+            for (size_t n = i; n < last; ++n)
+            {
+                const build_input &input = inputs[n];
+                if (input.kernels.empty() && input.work_group_sizes.empty() && input.coalesced.empty())
+                {
+                    fns.push_back(input.filename.c_str());
+                    loaded.push_back(n);
+                }
+            }
+            load_files(fns, sources);
+            batch_sources.assign(last - i, nullptr);
+            for (size_t n = 0; n < loaded.size(); ++n)
+            {
+                batch_sources[loaded[n] - i] = sources[n];
+            }
+        }
+
+        build_input &input = inputs[i];
+        char *source = batch_sources[i % batch];
+        if (!source)
+        {
+            kept.push_back(std::move(input));
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+
+        // extensions enabled by a source would stay enabled for the sources following it
+        std::string normalized = normalize_source(text);
+        std::set<std::string> names;
+        if (normalized.size() >= max_bytes || has_extension_pragmas(text) || !declared_names(text, names))
+        {
+            kept.push_back(std::move(input));
+            continue;
+        }
+        kernels[i] = kernel_names(text);
+
+        // combined programs are told apart by build options and builders, then by source
+        std::string key = input.options + '\n';
+        for (size_t b : input.builders)
+        {
+            key += std::to_string(b) + ',';
+        }
+        auto first = coalesced.find(key + '\n' + normalized);
+        if (first != coalesced.end())
+        {
+            duplicates.push_back(std::make_pair(i, first->second));
+            continue;
+        }
+        coalesced[key + '\n' + normalized] = i;
+
+        // first fit, among the programs built the same way
+        size_t p = 0;
+        for (; p < programs.size(); ++p)
+        {
+            const combined &c = programs[p];
+            const build_input &other = inputs[c.members.front()];
+            if (other.options == input.options && other.builders == input.builders &&
+                c.bytes + normalized.size() <= max_bytes &&
+                std::none_of(names.begin(), names.end(), [&c](const std::string &n) { return c.names.count(n); }))
+            {
+                break;
+            }
+        }
+        if (p == programs.size())
+        {
+            programs.emplace_back();
+        }
+        programs[p].members.push_back(i);
+        programs[p].names.insert(names.begin(), names.end());
+        programs[p].bytes += normalized.size();
+        program_of[i] = p;
+    }
+
+    // programs left with a single member are built as they are
+    size_t count = 0;
+    std::vector<std::string> program_names(programs.size());
+    for (size_t p = 0; p < programs.size(); ++p)
+    {
+        const combined &c = programs[p];
+        if (c.members.size() == 1)
+        {
+            kept.push_back(std::move(inputs[c.members.front()]));
+            continue;
+        }
+
+        build_input input = inputs[c.members.front()];
+        input.name = "coalesced." + std::to_string(count++);
+        for (size_t m = 1; m < c.members.size(); ++m)
+        {
+            input.coalesced.push_back(inputs[c.members[m]].filename);
+        }
+        for (size_t m : c.members)
+        {
+            for (const std::string &kernel : kernels[m])
+            {
+                maps[inputs[m].name][kernel] = input.name;
+            }
+        }
+        program_names[p] = input.name;
+        kept.push_back(std::move(input));
+    }
+
+    for (const auto &d : duplicates)
+    {
+        const std::string &name = program_names[program_of[d.second]];
+        if (name.empty())
+        {
+            kept.push_back(std::move(inputs[d.first]));
+            continue;
+        }
+        for (const std::string &kernel : kernels[d.first])
+        {
+            maps[inputs[d.first].name][kernel] = name;
+        }
+    }
+
+    if (count)
+    {
+        loginfo("coalesced %zu programs into %zu\n", inputs.size() - kept.size() + count, count);
+    }
+    inputs = std::move(kept);
+}
+
+} // namespace clc
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef split_h
+#define split_h
+
+#include "driver.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Attributes the build time of every input to its kernels
+ *
+ * Every input is built as is, then once per kernel with the other kernels dropped, see @ref select_kernels, all the
+ * builds running concurrently. The build time and binary size of the whole program and of each kernel built in
+ * isolation are printed to stdout, the kernels sorted from the slowest to build. The binary cache is bypassed.
+ *
+ * @param[in] builders Builders of the targeted devices
+ * @param[in] inputs Inputs to build
+ * @param[in] jobs Maximum number of concurrent builds
+ * @return true if every build succeeded, false otherwise
+ */
+bool attribute_build_times(const std::vector<std::unique_ptr<device_builder>> &builders,
+                           const std::vector<build_input> &inputs, unsigned jobs);
+
+/** Splits the inputs with several kernels into partitions building concurrently
+ *
+ * The kernels of an input are spread over at most @p partitions programs named "<program name>.part<index>", each
+ * keeping the helper functions its kernels depend on, see @ref extract_kernels. The cost of a kernel is estimated by
+ * the size of its normalized source along with its helpers, and the kernels are assigned from the most costly to the
+ * partition with the lowest cost so far, balancing the build times. Helpers shared by kernels of different partitions
+ * are built in each of them.
+ *
+ * @param[in,out] inputs Inputs to build, the split ones replaced by their partitions
+ * @param[in] partitions Maximum number of partitions per input
+ * @param[out] maps Receives the partition holding each kernel of the split inputs, keyed by program name then kernel
+ * name, see @ref kernel_map_data
+ */
+void split_inputs(std::vector<build_input> &inputs, unsigned partitions,
+                  std::map<std::string, std::map<std::string, std::string>> &maps);
+
+/** Coalesces the small inputs into combined programs, amortizing the per program overhead of the driver
+ *
+ * Inputs whose normalized source is smaller than @p max_bytes are concatenated into programs named
+ * "coalesced.<index>" of at most @p max_bytes, see @ref coalesce_sources. Only inputs with the same build options and
+ * builders are combined, as long as the names they declare do not conflict, see @ref declared_names. Sources
+ * including other files or enabling extensions are left alone, see @ref has_extension_pragmas, as are duplicates,
+ * which map to the combined program of the first one.
+ *
+ * @param[in,out] inputs Inputs to build, the coalesced ones replaced by the combined programs
+ * @param[in] max_bytes Maximum normalized source size of a combined program
+ * @param[in,out] maps Receives the combined program holding each kernel of the coalesced inputs, keyed by program
+ * name then kernel name, see @ref kernel_map_data
+ */
+void coalesce_inputs(std::vector<build_input> &inputs, size_t max_bytes,
+                     std::map<std::string, std::map<std::string, std::string>> &maps);
+
+} // namespace clc
+
+#endif // split_h
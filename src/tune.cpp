@@ -0,0 +1,436 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "tune.h"
+#include "clc.h"
+#include "file.h"
+#include "log.h"
+#include "parallel.h"
+#include "scope_guard.h"
+#include "source.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace clc
+{
+
+namespace
+{
+
+/** Compares the outputs of a kernel against reference ones
+ *
+ * @param[in] outputs Buffer contents, read as floats
+ * @param[in] reference Reference buffer contents
+ * @return The maximum relative error, infinite if the outputs do not match in size or in NaNs
+ */
+double max_relative_error(const std::vector<std::vector<unsigned char>> &outputs,
+                          const std::vector<std::vector<unsigned char>> &reference)
+{
+    if (outputs.size() != reference.size())
+    {
+        return INFINITY;
+    }
+
+    double max = 0;
+    for (size_t b = 0; b < outputs.size(); ++b)
+    {
+        const std::vector<unsigned char> &out = outputs[b];
+        const std::vector<unsigned char> &ref = reference[b];
+        if (out.size() != ref.size())
+        {
+            return INFINITY;
+        }
+        for (size_t i = 0; i + sizeof(float) <= out.size(); i += sizeof(float))
+        {
+            float o;
+            float r;
+            std::memcpy(&o, &out[i], sizeof(o));
+            std::memcpy(&r, &ref[i], sizeof(r));
+            if (std::isnan(o) || std::isnan(r))
+            {
+                if (std::isnan(o) != std::isnan(r))
+                {
+                    return INFINITY;
+                }
+                continue;
+            }
+            if (o != r)
+            {
+                max = std::max(max, std::fabs(static_cast<double>(o) - r) / std::max(std::fabs(r), FLT_MIN));
+            }
+        }
+    }
+    return max;
+}
+
+/** Appends build options to others
+ * @param[in] options Build options
+ * @param[in] more Build options to append
+ * @return The combined build options
+ */
+std::string join(const std::string &options, const std::string &more)
+{
+    return options.empty() || more.empty() ? options + more : options + ' ' + more;
+}
+
+} // namespace
+
+std::vector<std::string> tune_option_candidates()
+{
+    return {
+        "",
+        "-cl-mad-enable",
+        "-cl-no-signed-zeros",
+        "-cl-mad-enable -cl-no-signed-zeros",
+        "-cl-unsafe-math-optimizations",
+        "-cl-fast-relaxed-math",
+    };
+}
+
+bool tune_options(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<build_input> &inputs,
+                  const std::vector<kernel_spec> &specs, const option_tuning &settings)
+{
+    std::vector<std::unique_ptr<kernel_runner>> runners;
+    for (const auto &c : compilers)
+    {
+        runners.emplace_back(new kernel_runner);
+        if (!runners.back()->init(*c))
+        {
+            return false;
+        }
+    }
+
+    const std::vector<std::string> candidates = tune_option_candidates();
+    bool ok = true;
+    for (const build_input &input : inputs)
+    {
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            ok = false;
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+
+        for (size_t d = 0; d < compilers.size(); ++d)
+        {
+            if (!input.builders.empty() &&
+                std::find(input.builders.begin(), input.builders.end(), d) == input.builders.end())
+            {
+                continue;
+            }
+            const compiler &c = *compilers[d];
+
+            // candidates build concurrently, the benchmarks then run one at a time
+            std::vector<cl_program> programs(candidates.size(), nullptr);
+            on_scope_guard([&programs]() {
+                for (cl_program p : programs)
+                {
+                    if (p)
+                    {
+                        clReleaseProgram(p);
+                    }
+                }
+            });
+            parallel_for(candidates.size(), settings.jobs, [&](size_t i) {
+                programs[i] = c.build_program(text.c_str(), join(input.options, candidates[i]).c_str());
+            });
+            if (!programs[0])
+            {
+                logerr("failed building the reference of \"%s\"\n", input.filename.c_str());
+                ok = false;
+                continue;
+            }
+
+            for (const std::string &kernel : get_kernel_names(programs[0]))
+            {
+                auto spec = std::find_if(specs.begin(), specs.end(),
+                                         [&kernel](const kernel_spec &s) { return s.kernel == kernel; });
+                if (spec == specs.end())
+                {
+                    loginfo("no spec for the kernel \"%s\", not tuning it\n", kernel.c_str());
+                    continue;
+                }
+
+                kernel_timing reference;
+                size_t best = candidates.size();
+                double best_time = 0;
+                for (size_t i = 0; i < candidates.size(); ++i)
+                {
+                    kernel_timing timing;
+                    if (!programs[i] || !runners[d]->run(programs[i], *spec, settings.runs, timing))
+                    {
+                        loginfo("skipping the options \"%s\" for \"%s\"\n", candidates[i].c_str(), kernel.c_str());
+                        continue;
+                    }
+                    if (i == 0)
+                    {
+                        reference = timing;
+                    }
+                    else if (settings.tolerance >= 0)
+                    {
+                        double error = max_relative_error(timing.outputs, reference.outputs);
+                        if (error > settings.tolerance)
+                        {
+                            loginfo("the options \"%s\" exceed the tolerance for \"%s\" (relative error=%g)\n",
+                                    candidates[i].c_str(), kernel.c_str(), error);
+                            continue;
+                        }
+                    }
+                    if (best == candidates.size() || timing.median < best_time)
+                    {
+                        best = i;
+                        best_time = timing.median;
+                    }
+                }
+
+                if (best == candidates.size() || reference.runs == 0)
+                {
+                    logerr("failed tuning the kernel \"%s\" of \"%s\"\n", kernel.c_str(), input.filename.c_str());
+                    ok = false;
+                    continue;
+                }
+                std::printf("tune: program=%s kernel=%s device=\"%s\" options=\"%s\" median_us=%.3f "
+                            "reference_us=%.3f speedup=%.2f\n",
+                            input.name.c_str(), kernel.c_str(), c.identity().c_str(), candidates[best].c_str(),
+                            best_time * 1e6, reference.median * 1e6, best_time > 0 ? reference.median / best_time : 1);
+            }
+        }
+    }
+    return ok;
+}
+
+std::vector<std::vector<size_t>> local_size_candidates(cl_uint dims, const size_t *global, size_t max_size,
+                                                       size_t multiple, const size_t *max_items)
+{
+    std::vector<std::vector<size_t>> all(1);
+    for (cl_uint d = 0; d < dims; ++d)
+    {
+        std::vector<std::vector<size_t>> expanded;
+        for (const std::vector<size_t> &c : all)
+        {
+            size_t items = 1;
+            for (size_t l : c)
+            {
+                items *= l;
+            }
+            for (size_t l = 1; l <= max_items[d] && items * l <= max_size; l *= 2)
+            {
+                if (global[d] % l == 0)
+                {
+                    expanded.push_back(c);
+                    expanded.back().push_back(l);
+                }
+            }
+        }
+        all.swap(expanded);
+    }
+
+    std::vector<std::vector<size_t>> preferred;
+    for (const std::vector<size_t> &c : all)
+    {
+        size_t items = 1;
+        for (size_t l : c)
+        {
+            items *= l;
+        }
+        if (multiple <= 1 || items % multiple == 0)
+        {
+            preferred.push_back(c);
+        }
+    }
+    return preferred.empty() ? all : preferred;
+}
+
+bool tune_work_groups(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<build_input> &inputs,
+                      const std::vector<kernel_spec> &specs, unsigned runs, tuning_db &db)
+{
+    std::vector<std::unique_ptr<kernel_runner>> runners;
+    for (const auto &c : compilers)
+    {
+        runners.emplace_back(new kernel_runner);
+        if (!runners.back()->init(*c))
+        {
+            return false;
+        }
+    }
+
+    bool ok = true;
+    for (const build_input &input : inputs)
+    {
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            ok = false;
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+
+        for (size_t d = 0; d < compilers.size(); ++d)
+        {
+            if (!input.builders.empty() &&
+                std::find(input.builders.begin(), input.builders.end(), d) == input.builders.end())
+            {
+                continue;
+            }
+            const compiler &c = *compilers[d];
+
+            size_t max_items[3] = {1, 1, 1};
+            clGetDeviceInfo(c.device(), CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_items), max_items, nullptr);
+
+            cl_program program = c.build_program(text.c_str(), input.options.c_str());
+            if (!program)
+            {
+                logerr("failed building \"%s\"\n", input.filename.c_str());
+                ok = false;
+                continue;
+            }
+            on_scope_guard([program]() { clReleaseProgram(program); });
+
+            for (const std::string &name : get_kernel_names(program))
+            {
+                auto spec = std::find_if(specs.begin(), specs.end(),
+                                         [&name](const kernel_spec &s) { return s.kernel == name; });
+                if (spec == specs.end())
+                {
+                    loginfo("no spec for the kernel \"%s\", not tuning it\n", name.c_str());
+                    continue;
+                }
+
+                size_t max_size = 0;
+                size_t multiple = 1;
+                cl_int err = CL_INVALID_KERNEL;
+                cl_kernel kernel = clCreateKernel(program, name.c_str(), &err);
+                if (err == CL_SUCCESS)
+                {
+                    err = clGetKernelWorkGroupInfo(kernel, c.device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size),
+                                                   &max_size, nullptr);
+                    clGetKernelWorkGroupInfo(kernel, c.device(), CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                             sizeof(multiple), &multiple, nullptr);
+                    clReleaseKernel(kernel);
+                }
+                if (err != CL_SUCCESS)
+                {
+                    logerr("failed querying the work-group size of \"%s\" (err=%s)\n", name.c_str(),
+                           cl_error_str(err));
+                    ok = false;
+                    continue;
+                }
+
+                // the local size chosen by the driver is the reference
+                kernel_spec candidate = *spec;
+                candidate.local[0] = candidate.local[1] = candidate.local[2] = 0;
+                kernel_timing reference;
+                if (!runners[d]->run(program, candidate, runs, reference))
+                {
+                    ok = false;
+                    continue;
+                }
+
+                std::vector<size_t> best;
+                double best_time = 0;
+                for (const std::vector<size_t> &local : local_size_candidates(spec->dims, spec->global, max_size,
+                                                                              multiple, max_items))
+                {
+                    std::copy(local.begin(), local.end(), candidate.local);
+                    kernel_timing timing;
+                    if (!runners[d]->run(program, candidate, runs, timing))
+                    {
+                        loginfo("skipping the local size %s for \"%s\"\n",
+                                ndrange_str(spec->dims, local.data()).c_str(), name.c_str());
+                        continue;
+                    }
+                    if (best.empty() || timing.median < best_time)
+                    {
+                        best = local;
+                        best_time = timing.median;
+                    }
+                }
+
+                if (best.empty())
+                {
+                    logerr("no local size could run the kernel \"%s\" of \"%s\"\n", name.c_str(),
+                           input.filename.c_str());
+                    ok = false;
+                    continue;
+                }
+                db.record(kernel_hash(text, input.options, name), c.identity(), spec->dims, spec->global, best.data(),
+                          best_time);
+                std::printf("tune: program=%s kernel=%s device=\"%s\" global=%s local=%s median_us=%.3f "
+                            "driver_us=%.3f speedup=%.2f max_work_group_size=%zu preferred_multiple=%zu\n",
+                            input.name.c_str(), name.c_str(), c.identity().c_str(),
+                            ndrange_str(spec->dims, spec->global).c_str(), ndrange_str(spec->dims, best.data()).c_str(),
+                            best_time * 1e6, reference.median * 1e6, best_time > 0 ? reference.median / best_time : 1,
+                            max_size, multiple);
+            }
+        }
+    }
+    return ok;
+}
+
+void specialize_inputs(const std::vector<std::unique_ptr<device_builder>> &builders, const tuning_db &db,
+                       std::vector<build_input> &inputs)
+{
+    typedef std::map<std::string, std::vector<size_t>> size_map;
+
+    const size_t count = inputs.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const build_input input = inputs[i];
+        char *source = load_file(input.filename.c_str());
+        if (!source)
+        {
+            // reported by the build
+            continue;
+        }
+        std::string text(source);
+        delete[] source;
+        const std::vector<std::string> kernels = kernel_names(text);
+
+        std::map<size_map, std::vector<size_t>> variants;
+        for (size_t b = 0; b < builders.size(); ++b)
+        {
+            if (!input.builders.empty() &&
+                std::find(input.builders.begin(), input.builders.end(), b) == input.builders.end())
+            {
+                continue;
+            }
+
+            size_map sizes;
+            for (const std::string &kernel : kernels)
+            {
+                std::vector<size_t> local;
+                if (db.best(kernel_hash(text, input.options, kernel), builders[b]->identity(), local))
+                {
+                    sizes[kernel] = local;
+                }
+            }
+            if (!sizes.empty())
+            {
+                variants[sizes].push_back(b);
+            }
+        }
+
+        for (const auto &v : variants)
+        {
+            build_input specialized = input;
+            specialized.name += ".reqd";
+            specialized.builders = v.second;
+            specialized.work_group_sizes = v.first;
+            inputs.push_back(std::move(specialized));
+        }
+        if (variants.empty())
+        {
+            loginfo("no tuned kernel in \"%s\", not specializing it\n", input.filename.c_str());
+        }
+    }
+}
+
+} // namespace clc
@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef tune_h
+#define tune_h
+
+#include "bench.h"
+#include "driver.h"
+#include "tuning.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+class compiler;
+
+/** Settings of the build option tuner */
+struct option_tuning
+{
+    /** Number of timed runs per kernel and candidate */
+    unsigned runs = 10;
+
+    /** Maximum number of concurrent candidate builds */
+    unsigned jobs = 1;
+
+    /** Maximum relative error of the candidate outputs against the reference build, negative for no check */
+    double tolerance = -1;
+};
+
+/** Lists the option sets tried by the build option tuner
+ *
+ * The sets combine -cl-mad-enable, -cl-no-signed-zeros, -cl-unsafe-math-optimizations and -cl-fast-relaxed-math,
+ * without the combinations the OpenCL specification makes redundant: -cl-unsafe-math-optimizations implies the first
+ * two and is implied by -cl-fast-relaxed-math. The first set is empty, the reference build.
+ *
+ * @return The option sets
+ */
+std::vector<std::string> tune_option_candidates();
+
+/** Searches the fastest math option set of each benchmarked kernel of every input on every device it targets
+ *
+ * The candidates of a program are built concurrently, then benchmarked one at a time with the @ref kernel_runner.
+ * Candidates whose outputs differ from the ones of the reference build by more than the tolerance are rejected. The
+ * fastest option set of each kernel is printed to stdout along with its speedup over the reference build.
+ *
+ * @param[in] compilers Compiler of each device, indexed like the @ref build_input::builders
+ * @param[in] inputs Inputs to tune, their build options are kept in every candidate
+ * @param[in] specs Kernel specs, see @ref load_kernel_specs
+ * @param[in] settings Tuning settings
+ * @return true if every input was tuned, false otherwise
+ */
+bool tune_options(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<build_input> &inputs,
+                  const std::vector<kernel_spec> &specs, const option_tuning &settings);
+
+/** Lists the local sizes tried by the work-group size tuner
+ *
+ * Sizes are powers of two in each dimension dividing the global size, within the work-group size limits of the
+ * kernel and device. Sizes that are not a multiple of the preferred work-group size multiple are skipped when others
+ * are.
+ *
+ * @param[in] dims Number of dimensions
+ * @param[in] global Global size
+ * @param[in] max_size Maximum work-group size of the kernel, CL_KERNEL_WORK_GROUP_SIZE
+ * @param[in] multiple Preferred work-group size multiple, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+ * @param[in] max_items Maximum size of each dimension, CL_DEVICE_MAX_WORK_ITEM_SIZES
+ * @return The candidate local sizes
+ */
+std::vector<std::vector<size_t>> local_size_candidates(cl_uint dims, const size_t *global, size_t max_size,
+                                                       size_t multiple, const size_t *max_items);
+
+/** Searches the fastest local size of each benchmarked kernel of every input on every device it targets
+ *
+ * Every candidate local size runs at the global size of the kernel spec, the fastest one is printed to stdout along
+ * with its speedup over the local size the driver chooses, and recorded into the tuning database.
+ *
+ * @param[in] compilers Compiler of each device, indexed like the @ref build_input::builders
+ * @param[in] inputs Inputs to tune
+ * @param[in] specs Kernel specs, see @ref load_kernel_specs
+ * @param[in] runs Number of timed runs per kernel and candidate
+ * @param[in,out] db Tuning database receiving the best local sizes
+ * @return true if every input was tuned, false otherwise
+ */
+bool tune_work_groups(const std::vector<std::unique_ptr<compiler>> &compilers, const std::vector<build_input> &inputs,
+                      const std::vector<kernel_spec> &specs, unsigned runs, tuning_db &db);
+
+/** Appends the specialized variants of the inputs whose kernels have tuned local sizes
+ *
+ * A variant named "<program name>.reqd" adds the reqd_work_group_size attribute of the tuned local size to the
+ * kernels of the program, see @ref specialize_source. When a kernel was tuned for several global sizes, the local
+ * size tuned for the most work-items is used. Devices sharing the same tuned sizes share the same variant.
+ *
+ * @param[in] builders Builders of the targeted devices
+ * @param[in] db Tuning database, see @ref tune_work_groups
+ * @param[in,out] inputs Inputs to build, receiving the specialized variants
+ */
+void specialize_inputs(const std::vector<std::unique_ptr<device_builder>> &builders, const tuning_db &db,
+                       std::vector<build_input> &inputs);
+
+} // namespace clc
+
+#endif // tune_h
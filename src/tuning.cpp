@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "tuning.h"
+#include "hash.h"
+#include "log.h"
+#include "source.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+namespace clc
+{
+
+bool parse_ndrange(const std::string &text, cl_uint &dims, size_t size[3])
+{
+    const char *p = text.c_str();
+    for (dims = 0; dims < 3;)
+    {
+        char *end;
+        unsigned long long v = std::strtoull(p, &end, 10);
+        if (end == p || v == 0)
+        {
+            return false;
+        }
+        size[dims++] = static_cast<size_t>(v);
+        if (!*end)
+        {
+            return true;
+        }
+        if (*end != 'x')
+        {
+            return false;
+        }
+        p = end + 1;
+    }
+    return false;
+}
+
+std::string ndrange_str(cl_uint dims, const size_t *size)
+{
+    std::string text;
+    for (cl_uint d = 0; d < dims; ++d)
+    {
+        if (d)
+        {
+            text += 'x';
+        }
+        text += std::to_string(size[d]);
+    }
+    return text;
+}
+
+uint64_t kernel_hash(const std::string &source, const std::string &options, const std::string &kernel)
+{
+    return fnv1a64(kernel, fnv1a64(normalize_source(source), fnv1a64(options)));
+}
+
+bool tuning_db::load(const std::string &fn)
+{
+    std::ifstream in(fn);
+    if (!in)
+    {
+        return true;
+    }
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        // <hash>\t<global>\t<local>\t<seconds>\t<identity>
+        size_t f1 = line.find('\t');
+        size_t f2 = f1 == std::string::npos ? f1 : line.find('\t', f1 + 1);
+        size_t f3 = f2 == std::string::npos ? f2 : line.find('\t', f2 + 1);
+        size_t f4 = f3 == std::string::npos ? f3 : line.find('\t', f3 + 1);
+        if (f4 == std::string::npos)
+        {
+            continue;
+        }
+
+        char *end;
+        uint64_t hash = std::strtoull(line.c_str(), &end, 16);
+        cl_uint global_dims;
+        cl_uint local_dims;
+        size_t global[3];
+        size_t local[3];
+        entry e;
+        e.seconds = std::strtod(line.c_str() + f3 + 1, nullptr);
+        if (end != line.c_str() + f1 || !parse_ndrange(line.substr(f1 + 1, f2 - f1 - 1), global_dims, global) ||
+            !parse_ndrange(line.substr(f2 + 1, f3 - f2 - 1), local_dims, local) || global_dims != local_dims)
+        {
+            continue;
+        }
+        e.local.assign(local, local + local_dims);
+
+        kernel_key key(hash, line.substr(f4 + 1));
+        m_entries[std::make_pair(key, std::vector<size_t>(global, global + global_dims))] = e;
+    }
+    return true;
+}
+
+bool tuning_db::save(const std::string &fn) const
+{
+    std::string tmp_fn = fn + ".tmp";
+    FILE *f = std::fopen(tmp_fn.c_str(), "w");
+    if (!f)
+    {
+        logerr("failed creating the tuning database \"%s\"\n", tmp_fn.c_str());
+        return false;
+    }
+
+    bool written = true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto &e : m_entries)
+        {
+            const std::vector<size_t> &global = e.first.second;
+            const std::vector<size_t> &local = e.second.local;
+            written = written && std::fprintf(f, "%s\t%s\t%s\t%.9f\t%s\n", hash_str(e.first.first.first).c_str(),
+                                              ndrange_str(static_cast<cl_uint>(global.size()), global.data()).c_str(),
+                                              ndrange_str(static_cast<cl_uint>(local.size()), local.data()).c_str(),
+                                              e.second.seconds, e.first.first.second.c_str()) > 0;
+        }
+    }
+
+    if (std::fclose(f) != 0 || !written || std::rename(tmp_fn.c_str(), fn.c_str()) != 0)
+    {
+        logerr("failed writing the tuning database \"%s\"\n", fn.c_str());
+        std::remove(tmp_fn.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool tuning_db::find(uint64_t hash, const std::string &identity, cl_uint dims, const size_t *global,
+                     size_t *local) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    kernel_key key(hash, identity);
+    std::vector<size_t> requested(global, global + dims);
+    auto found = m_entries.find(std::make_pair(key, requested));
+    if (found == m_entries.end())
+    {
+        // nearest tuned global size whose local size still divides the requested one
+        double items = 1;
+        for (size_t g : requested)
+        {
+            items *= g;
+        }
+        double best = 0;
+        for (auto e = m_entries.lower_bound(std::make_pair(key, std::vector<size_t>())); e != m_entries.end(); ++e)
+        {
+            if (e->first.first != key)
+            {
+                break;
+            }
+            if (e->second.local.size() != dims)
+            {
+                continue;
+            }
+
+            bool divides = true;
+            double tuned_items = 1;
+            for (cl_uint d = 0; d < dims; ++d)
+            {
+                divides = divides && global[d] % e->second.local[d] == 0;
+                tuned_items *= e->first.second[d];
+            }
+            double distance = tuned_items > items ? tuned_items / items : items / tuned_items;
+            if (divides && (found == m_entries.end() || distance < best))
+            {
+                found = e;
+                best = distance;
+            }
+        }
+        if (found == m_entries.end())
+        {
+            return false;
+        }
+    }
+
+    for (cl_uint d = 0; d < dims; ++d)
+    {
+        local[d] = found->second.local[d];
+    }
+    return true;
+}
+
+bool tuning_db::best(uint64_t hash, const std::string &identity, std::vector<size_t> &local) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    kernel_key key(hash, identity);
+    double most = 0;
+    bool found = false;
+    for (auto e = m_entries.lower_bound(std::make_pair(key, std::vector<size_t>())); e != m_entries.end(); ++e)
+    {
+        if (e->first.first != key)
+        {
+            break;
+        }
+
+        double items = 1;
+        for (size_t g : e->first.second)
+        {
+            items *= g;
+        }
+        if (!found || items > most)
+        {
+            local = e->second.local;
+            most = items;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void tuning_db::record(uint64_t hash, const std::string &identity, cl_uint dims, const size_t *global,
+                       const size_t *local, double seconds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    entry e;
+    e.local.assign(local, local + dims);
+    e.seconds = seconds;
+    m_entries[std::make_pair(kernel_key(hash, identity), std::vector<size_t>(global, global + dims))] = e;
+}
+
+} // namespace clc
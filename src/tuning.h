@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef tuning_h
+#define tuning_h
+
+#include <CL/cl.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace clc
+{
+
+/** Parses an NDRange size
+ * @param[in] text Size as <x>[x<y>[x<z>]]
+ * @param[out] dims Receives the number of dimensions
+ * @param[out] size Receives the size of each dimension
+ * @return true if succeeded, false if malformed
+ */
+bool parse_ndrange(const std::string &text, cl_uint &dims, size_t size[3]);
+
+/** Formats an NDRange size
+ * @param[in] dims Number of dimensions
+ * @param[in] size Size of each dimension
+ * @return The size as <x>[x<y>[x<z>]]
+ */
+std::string ndrange_str(cl_uint dims, const size_t *size);
+
+/** Hashes a kernel as built from a source
+ *
+ * @param[in] source Program source text, normalized before hashing, see @ref normalize_source
+ * @param[in] options Build options
+ * @param[in] kernel Kernel name
+ * @return The kernel hash
+ */
+uint64_t kernel_hash(const std::string &source, const std::string &options, const std::string &kernel);
+
+/** Best work-group sizes found by the work-group size tuner
+ *
+ * Sizes are keyed by kernel hash, device identity and global size. The file lists one kernel per line as tab
+ * separated fields:
+ *
+ *     <kernel hash><TAB><global size><TAB><local size><TAB><seconds><TAB><device identity>
+ */
+class tuning_db
+{
+  public:
+    /** Loads the database, a missing file is an empty database
+     * @param[in] fn Database filename
+     * @return true if succeeded, false otherwise
+     */
+    bool load(const std::string &fn);
+
+    /** Saves the database
+     * @param[in] fn Database filename
+     * @return true if succeeded, false otherwise
+     */
+    bool save(const std::string &fn) const;
+
+    /** Looks the local size of a kernel up
+     *
+     * The size tuned for the same global size is preferred, the one tuned for the nearest global size in number of
+     * work-items otherwise, as long as it divides the requested global size.
+     *
+     * @param[in] hash Kernel hash, see @ref kernel_hash
+     * @param[in] identity Device identity, see @ref device_identity
+     * @param[in] dims Number of dimensions
+     * @param[in] global Global size
+     * @param[out] local Receives the local size
+     * @return true if found, false otherwise
+     */
+    bool find(uint64_t hash, const std::string &identity, cl_uint dims, const size_t *global, size_t *local) const;
+
+    /** Looks up the local size of a kernel whatever the global size, the one tuned for the most work-items
+     *
+     * @param[in] hash Kernel hash, see @ref kernel_hash
+     * @param[in] identity Device identity, see @ref device_identity
+     * @param[out] local Receives the local size, one entry per dimension
+     * @return true if found, false otherwise
+     */
+    bool best(uint64_t hash, const std::string &identity, std::vector<size_t> &local) const;
+
+    /** Records the best local size of a kernel, replacing the previous one
+     *
+     * @param[in] hash Kernel hash, see @ref kernel_hash
+     * @param[in] identity Device identity, see @ref device_identity
+     * @param[in] dims Number of dimensions
+     * @param[in] global Global size
+     * @param[in] local Best local size
+     * @param[in] seconds Execution time with that local size
+     */
+    void record(uint64_t hash, const std::string &identity, cl_uint dims, const size_t *global, const size_t *local,
+                double seconds);
+
+  private:
+    /** kernel hash and device identity */
+    typedef std::pair<uint64_t, std::string> kernel_key;
+
+    /** tuned local size */
+    struct entry
+    {
+        std::vector<size_t> local;
+        double seconds = 0;
+    };
+
+    /** tuned local sizes keyed by kernel and global size */
+    std::map<std::pair<kernel_key, std::vector<size_t>>, entry> m_entries;
+
+    /** serializes concurrent accesses */
+    mutable std::mutex m_mutex;
+};
+
+} // namespace clc
+
+#endif // tuning_h
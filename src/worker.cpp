@@ -0,0 +1,542 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#include "worker.h"
+#include "clc.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#ifndef _WIN32
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace clc
+{
+
+#ifndef _WIN32
+
+namespace
+{
+
+/** Largest message accepted over a worker pipe */
+const uint64_t max_message_size = uint64_t(1) << 32;
+
+/** Writes a whole memory block to a file descriptor
+ * @return true if succeeded, false otherwise
+ */
+bool write_all(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size)
+    {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/** Reads a whole memory block from a file descriptor
+ * @return true if succeeded, false on error or end of file
+ */
+bool read_all(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size)
+    {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/** Waits for a file descriptor to become readable
+ * @param[in] fd File descriptor
+ * @param[in] deadline Time after which to give up
+ * @return true if readable, false if the deadline passed
+ */
+bool wait_readable(int fd, std::chrono::steady_clock::time_point deadline)
+{
+    for (;;)
+    {
+        auto remaining =
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0)
+        {
+            return false;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        int n = poll(&pfd, 1, static_cast<int>(std::min<long long>(remaining.count() + 1, 60000)));
+        if (n > 0)
+        {
+            return true;
+        }
+        if (n < 0 && errno != EINTR)
+        {
+            return true;
+        }
+    }
+}
+
+bool write_u64(int fd, uint64_t v)
+{
+    return write_all(fd, &v, sizeof(v));
+}
+
+bool read_u64(int fd, uint64_t &v)
+{
+    return read_all(fd, &v, sizeof(v));
+}
+
+/** Writes a size prefixed memory block */
+bool write_block(int fd, const void *data, size_t size)
+{
+    return write_u64(fd, size) && write_all(fd, data, size);
+}
+
+/** Reads a size prefixed memory block */
+template <typename T> bool read_block(int fd, T &block)
+{
+    uint64_t size;
+    if (!read_u64(fd, size) || size > max_message_size)
+    {
+        return false;
+    }
+    block.resize(static_cast<size_t>(size));
+    return block.empty() || read_all(fd, &block[0], block.size());
+}
+
+/** @return The resident memory size of the calling process in bytes, 0 if unknown */
+size_t resident_size()
+{
+    FILE *f = std::fopen("/proc/self/statm", "r");
+    if (!f)
+    {
+        return 0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int n = std::fscanf(f, "%lu %lu", &size, &resident);
+    std::fclose(f);
+    return n == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+}
+
+/** Describes how a worker ended
+ * @param[in] status Wait status
+ * @return The description
+ */
+std::string describe_status(int status)
+{
+    if (WIFSIGNALED(status))
+    {
+        return std::string("killed by signal ") + std::to_string(WTERMSIG(status));
+    }
+    return std::string("exited with code ") + std::to_string(WEXITSTATUS(status));
+}
+
+/** serializes process creations, so that no child inherits the pipes of another */
+std::mutex spawn_mutex;
+
+} // namespace
+
+worker_builder::worker_builder(std::string exe, cl_uint platform_id, cl_uint device_id, const worker_limits &limits)
+    : m_exe(std::move(exe)), m_platform_id(platform_id), m_device_id(device_id), m_limits(limits)
+{
+}
+
+worker_builder::~worker_builder()
+{
+    for (auto &p : m_idle)
+    {
+        terminate(p, false);
+    }
+}
+
+bool worker_builder::init()
+{
+    // a dead worker must fail its build, not the whole run
+    std::signal(SIGPIPE, SIG_IGN);
+
+    process p;
+    if (!spawn(p, m_identity))
+    {
+        return false;
+    }
+    m_idle.push_back(p);
+    return true;
+}
+
+bool worker_builder::inspect(const std::vector<unsigned char> &binary, const std::string &options,
+                             std::vector<kernel_resources> &kernels)
+{
+    compiler *inspector;
+    {
+        std::lock_guard<std::mutex> lock(m_inspector_mutex);
+        if (!m_inspector)
+        {
+            m_inspector.reset(new compiler);
+            if (!m_inspector->init(m_platform_id, m_device_id))
+            {
+                logerr("failed creating a context to inspect the binaries\n");
+            }
+        }
+        inspector = m_inspector.get();
+    }
+    return !inspector->identity().empty() && inspector->inspect(binary, options.c_str(), kernels);
+}
+
+bool worker_builder::spawn(process &p, std::string &identity) const
+{
+    std::string platform = std::to_string(m_platform_id);
+    std::string device = std::to_string(m_device_id);
+    const char *argv[] = {m_exe.c_str(), "--worker", platform.c_str(), device.c_str(), nullptr};
+
+    int requests[2];
+    int replies[2];
+    {
+        std::lock_guard<std::mutex> lock(spawn_mutex);
+        if (pipe(requests) != 0)
+        {
+            logerr("failed creating the worker pipes\n");
+            return false;
+        }
+        if (pipe(replies) != 0)
+        {
+            logerr("failed creating the worker pipes\n");
+            close(requests[0]);
+            close(requests[1]);
+            return false;
+        }
+        fcntl(requests[1], F_SETFD, FD_CLOEXEC);
+        fcntl(replies[0], F_SETFD, FD_CLOEXEC);
+
+        p.pid = fork();
+        if (p.pid == 0)
+        {
+            dup2(requests[0], STDIN_FILENO);
+            dup2(replies[1], STDOUT_FILENO);
+            close(requests[0]);
+            close(replies[1]);
+            execv(argv[0], const_cast<char *const *>(argv));
+            _exit(127);
+        }
+        close(requests[0]);
+        close(replies[1]);
+    }
+
+    p.in = requests[1];
+    p.out = replies[0];
+    p.builds = 0;
+    if (p.pid < 0)
+    {
+        logerr("failed spawning a worker process\n");
+        terminate(p, false);
+        return false;
+    }
+
+    // the worker first reports whether its context could be created, along with the device identity
+    uint64_t ready;
+    if (!read_u64(p.out, ready) || !read_block(p.out, identity) || !ready)
+    {
+        int status = terminate(p, false);
+        logerr("worker process failed to start (%s)\n", describe_status(status).c_str());
+        return false;
+    }
+    return true;
+}
+
+int worker_builder::terminate(process &p, bool kill) const
+{
+    if (p.in >= 0)
+    {
+        close(p.in);
+    }
+    if (p.out >= 0)
+    {
+        close(p.out);
+    }
+
+    // closing stdin makes an idle worker exit
+    int status = 0;
+    if (p.pid > 0)
+    {
+        if (kill)
+        {
+            ::kill(p.pid, SIGKILL);
+        }
+        while (waitpid(p.pid, &status, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    p = process();
+    return status;
+}
+
+bool worker_builder::acquire(process &p)
+{
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_idle.empty())
+            {
+                break;
+            }
+            p = m_idle.back();
+            m_idle.pop_back();
+        }
+
+        // an idle worker sends nothing, its reply pipe only gets readable or hung up once it died
+        struct pollfd pfd;
+        pfd.fd = p.out;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) <= 0)
+        {
+            return true;
+        }
+        int pid = p.pid;
+        int status = terminate(p, true);
+        loginfo("idle worker process %d died (%s), replacing it\n", pid, describe_status(status).c_str());
+    }
+
+    std::string identity;
+    return spawn(p, identity);
+}
+
+build_result worker_builder::build(const std::string &source, const std::string &options,
+                                   std::vector<unsigned char> *binary)
+{
+    process p;
+    bool sent = false;
+
+    // a worker dying before it got the whole request died idle, the build is retried once with another worker
+    for (unsigned attempt = 0; !sent; ++attempt)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_cancelled)
+            {
+                return build_result::cancelled;
+            }
+        }
+        if (!acquire(p))
+        {
+            return build_result::failed;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy.push_back(p.pid);
+        }
+
+        sent = write_block(p.in, source.data(), source.size()) &&
+               write_block(p.in, options.data(), options.size()) && write_u64(p.in, binary != nullptr);
+        if (sent || attempt > 0)
+        {
+            break;
+        }
+
+        bool cancelled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy.erase(std::find(m_busy.begin(), m_busy.end(), p.pid));
+            cancelled = m_cancelled;
+        }
+        int pid = p.pid;
+        int status = terminate(p, true);
+        if (cancelled)
+        {
+            return build_result::cancelled;
+        }
+        loginfo("worker process %d died before the build (%s), retrying with another one\n", pid,
+                describe_status(status).c_str());
+    }
+
+    bool timed_out = false;
+    if (sent && m_limits.timeout > 0)
+    {
+        auto timeout = std::chrono::duration<double>(m_limits.timeout);
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::milliseconds>(timeout);
+        timed_out = !wait_readable(p.out, deadline);
+    }
+
+    uint64_t built;
+    uint64_t rss;
+    std::vector<unsigned char> data;
+    bool received = sent && !timed_out && read_u64(p.out, built) && read_u64(p.out, rss) && read_block(p.out, data);
+
+    // the worker must leave the busy list before being reaped, so that cancel() never kills a recycled pid
+    bool cancelled;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy.erase(std::find(m_busy.begin(), m_busy.end(), p.pid));
+        cancelled = m_cancelled;
+    }
+
+    if (!received)
+    {
+        int pid = p.pid;
+        int status = terminate(p, true);
+        if (cancelled)
+        {
+            return build_result::cancelled;
+        }
+        if (timed_out)
+        {
+            return build_result::timed_out;
+        }
+        logerr("worker process %d died during the build (%s)\n", pid, describe_status(status).c_str());
+        return build_result::failed;
+    }
+
+    if (binary)
+    {
+        *binary = std::move(data);
+    }
+
+    ++p.builds;
+    if ((m_limits.max_builds && p.builds >= m_limits.max_builds) || (m_limits.max_rss && rss > m_limits.max_rss))
+    {
+        terminate(p, false);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.push_back(p);
+    }
+
+    return built ? build_result::success : build_result::failed;
+}
+
+void worker_builder::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cancelled = true;
+    for (int pid : m_busy)
+    {
+        ::kill(pid, SIGKILL);
+    }
+}
+
+std::string self_executable(const char *argv0)
+{
+    char path[4096];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (n <= 0)
+    {
+        return argv0;
+    }
+    path[n] = '\0';
+    return path;
+}
+
+int worker_main(cl_uint platform_id, cl_uint device_id)
+{
+    // stdout carries the replies, logs go to stderr
+    int replies = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    compiler c;
+    bool ready = c.init(platform_id, device_id);
+    if (!write_u64(replies, ready) || !write_block(replies, c.identity().data(), c.identity().size()) || !ready)
+    {
+        return EXIT_FAILURE;
+    }
+
+    std::string source;
+    std::string options;
+    uint64_t wants_binary;
+    while (read_block(STDIN_FILENO, source) && read_block(STDIN_FILENO, options) &&
+           read_u64(STDIN_FILENO, wants_binary))
+    {
+        std::vector<unsigned char> binary;
+        bool built = c.build(source.c_str(), options.c_str(), wants_binary ? &binary : nullptr);
+        std::fflush(stdout);
+        if (!write_u64(replies, built) || !write_u64(replies, resident_size()) ||
+            !write_block(replies, binary.data(), binary.size()))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#else
+
+worker_builder::worker_builder(std::string exe, cl_uint platform_id, cl_uint device_id, const worker_limits &limits)
+    : m_exe(std::move(exe)), m_platform_id(platform_id), m_device_id(device_id), m_limits(limits)
+{
+}
+
+worker_builder::~worker_builder()
+{
+}
+
+bool worker_builder::init()
+{
+    logerr("worker processes are not supported on this platform\n");
+    return false;
+}
+
+build_result worker_builder::build(const std::string &, const std::string &, std::vector<unsigned char> *)
+{
+    return build_result::failed;
+}
+
+bool worker_builder::inspect(const std::vector<unsigned char> &, const std::string &, std::vector<kernel_resources> &)
+{
+    logerr("worker processes are not supported on this platform\n");
+    return false;
+}
+
+void worker_builder::cancel()
+{
+}
+
+std::string self_executable(const char *argv0)
+{
+    return argv0;
+}
+
+int worker_main(cl_uint, cl_uint)
+{
+    logerr("worker processes are not supported on this platform\n");
+    return EXIT_FAILURE;
+}
+
+#endif
+
+} // namespace clc
@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: MIT
+// Copyright 2023 Edouard Gomez
+
+#ifndef worker_h
+#define worker_h
+
+#include "driver.h"
+
+#include <CL/cl.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace clc
+{
+
+/** Limits after which a worker process gets recycled */
+struct worker_limits
+{
+    /** Number of builds, 0 for no limit */
+    unsigned max_builds = 0;
+
+    /** Resident memory size in bytes, 0 for no limit */
+    size_t max_rss = 0;
+
+    /** Duration of a single build in seconds after which its worker gets killed, 0 for no limit */
+    double timeout = 0;
+};
+
+/** Builds programs in a pool of worker processes
+ *
+ * Each worker is the clcompile executable running @ref worker_main, owning its own OpenCL context. A worker crashing
+ * only fails the build it was running, the next build spawns a fresh worker. Workers are recycled once they reach
+ * the configured limits, so that leaks in the driver compiler do not accumulate over large batches. Workers exceeding
+ * the build timeout are killed, the build being reported as timed out.
+ */
+class worker_builder : public device_builder
+{
+  public:
+    /** ctor
+     * @param[in] exe Path of the clcompile executable
+     * @param[in] platform_id Platform index
+     * @param[in] device_id Device index
+     * @param[in] limits Worker recycling limits
+     */
+    worker_builder(std::string exe, cl_uint platform_id, cl_uint device_id, const worker_limits &limits);
+    ~worker_builder();
+
+    worker_builder(const worker_builder &) = delete;
+    worker_builder &operator=(const worker_builder &) = delete;
+
+    /** Spawns a first worker and retrieves the device identity from it
+     * @return true if succeeded, false otherwise
+     */
+    bool init();
+
+    const std::string &identity() const override
+    {
+        return m_identity;
+    }
+
+    build_result build(const std::string &source, const std::string &options,
+                       std::vector<unsigned char> *binary) override;
+
+    /** Inspects the binary within the clcompile process, loading a binary not running the compiler front end */
+    bool inspect(const std::vector<unsigned char> &binary, const std::string &options,
+                 std::vector<kernel_resources> &kernels) override;
+
+    /** Kills the workers running a build and fails any later build */
+    void cancel() override;
+
+  private:
+    /** Worker process */
+    struct process
+    {
+        /** process id, -1 if not running */
+        int pid = -1;
+
+        /** request pipe, the worker's stdin */
+        int in = -1;
+
+        /** reply pipe, the worker's stdout */
+        int out = -1;
+
+        /** number of builds served */
+        unsigned builds = 0;
+    };
+
+    /** Spawns a worker
+     * @param[out] p Receives the worker
+     * @param[out] identity Receives the device identity reported by the worker
+     * @return true if succeeded, false otherwise
+     */
+    bool spawn(process &p, std::string &identity) const;
+
+    /** Takes an idle worker, reaping the ones that died while idle, or spawns a new one when none is left
+     * @param[out] p Receives the worker
+     * @return true if succeeded, false otherwise
+     */
+    bool acquire(process &p);
+
+    /** Stops a worker and reaps it
+     * @param[in,out] p Worker to stop
+     * @param[in] kill Kill the worker rather than letting it exit on its own
+     * @return The wait status of the worker
+     */
+    int terminate(process &p, bool kill) const;
+
+    /** executable path */
+    std::string m_exe;
+
+    /** platform index */
+    cl_uint m_platform_id;
+
+    /** device index */
+    cl_uint m_device_id;
+
+    /** recycling limits */
+    worker_limits m_limits;
+
+    /** device identity */
+    std::string m_identity;
+
+    /** serializes the accesses to @ref m_idle, @ref m_busy and @ref m_cancelled */
+    std::mutex m_mutex;
+
+    /** idle workers */
+    std::vector<process> m_idle;
+
+    /** process ids of the workers running a build */
+    std::vector<int> m_busy;
+
+    /** set once the builds got cancelled */
+    bool m_cancelled = false;
+
+    /** serializes the creation of @ref m_inspector */
+    std::mutex m_inspector_mutex;
+
+    /** in process context inspecting the binaries, created on first use */
+    std::unique_ptr<compiler> m_inspector;
+};
+
+/** Returns the path of the running executable
+ * @param[in] argv0 First program argument, used when the path cannot be queried from the system
+ * @return The executable path
+ */
+std::string self_executable(const char *argv0);
+
+/** Entry point of a worker process, serves build requests on stdin until it gets closed
+ *
+ * @param[in] platform_id Platform index
+ * @param[in] device_id Device index
+ * @return Process exit code
+ */
+int worker_main(cl_uint platform_id, cl_uint device_id);
+
+} // namespace clc
+
+#endif // worker_h